@@ -0,0 +1,90 @@
+//! Parsing with 0, 100 and 1000 aliases defined, through the shell's alias
+//! table and through a shared AliasTable with per-parser caching. The
+//! AliasTable is measured with a fresh parser per sample, and with one
+//! long-lived parser reading lines from a pipe, as in an interactive shell.
+
+mod common;
+
+use std::fs::File;
+use std::io::Write;
+use std::os::unix::io::FromRawFd;
+use std::sync::Arc;
+use std::thread;
+
+use common::{bench_state, report, sample};
+use mrsh::{sys, AliasTable, Parser, Program};
+
+/// Short command lines, a quarter of which start with an alias.
+fn script() -> String {
+    let mut s = String::new();
+    for i in 0..2000 {
+        if i % 4 == 0 {
+            s += &format!("al_{} --flag \"$x\"\n", i % 100);
+        } else {
+            s += &format!("cmd_{} -v \"$x\" | filter_{} > out_{}\n", i, i % 7, i);
+        }
+    }
+    s
+}
+
+/// A parser reading `src` over and over from a pipe.
+fn endless_parser(src: &str, table: Arc<AliasTable>) -> Parser {
+    let mut fds = [-1; 2];
+    assert_eq!(unsafe { libc::pipe2(fds.as_mut_ptr(), libc::O_CLOEXEC) }, 0);
+    let (read, mut write) = unsafe { (File::from_raw_fd(fds[0]), File::from_raw_fd(fds[1])) };
+    let src = src.to_owned();
+    // Stops once the parser is dropped and the pipe is broken
+    thread::spawn(move || while write.write_all(src.as_bytes()).is_ok() {});
+    let mut parser = Parser::from_file(read).unwrap();
+    parser.set_aliases(table);
+    parser
+}
+
+fn main() {
+    let src = script();
+    let mut state = bench_state();
+    let table = Arc::new(AliasTable::new());
+    let mut defined = 0;
+    for &aliases in &[0, 100, 1000] {
+        let names = (defined..aliases)
+            .map(|i| (format!("al_{}", i), format!("command -p tool_{} -q", i)))
+            .collect::<Vec<_>>();
+        for (name, value) in &names {
+            let prog = Program::parse(format!("alias {}='{}'", name, value).as_bytes()).unwrap();
+            assert_eq!(state.run_program(&prog), 0);
+        }
+        table.extend(names.iter().map(|(n, v)| (n.as_str(), v.as_str())));
+        defined = aliases;
+
+        let s = sample(|| {
+            let mut parser = Parser::from_bytes(src.as_bytes());
+            unsafe { sys::mrsh_state_set_parser_alias_func(state.as_ptr(), parser.as_ptr()) };
+            parser.parse_program().unwrap();
+        });
+        report(&format!("state, {} aliases", aliases), &s, Some(src.len()));
+
+        let s = sample(|| {
+            let mut parser = Parser::from_bytes(src.as_bytes());
+            parser.set_aliases(table.clone());
+            parser.parse_program().unwrap();
+        });
+        report(
+            &format!("AliasTable, {} aliases", aliases),
+            &s,
+            Some(src.len()),
+        );
+
+        let lines = src.lines().count();
+        let mut parser = endless_parser(&src, table.clone());
+        let s = sample(|| {
+            for _ in 0..lines {
+                parser.parse_line().unwrap();
+            }
+        });
+        report(
+            &format!("AliasTable, {} aliases, reused", aliases),
+            &s,
+            Some(src.len()),
+        );
+    }
+}
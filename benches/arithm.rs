@@ -0,0 +1,43 @@
+//! Counter loops: the shell re-parses and re-walks `$((i + 1))` on every
+//! iteration, compared with evaluating the tree once parsed and with the
+//! compiled bytecode.
+
+mod common;
+
+use common::{bench_loop, bench_state, report, sample};
+use mrsh::{sys, ArithmExpr, CompiledArithm, Parser};
+
+const EXPR: &[u8] = b"i = i + 1";
+
+fn main() {
+    let mut state = bench_state();
+
+    state.env_set("i", "0", sys::MRSH_VAR_ATTRIB_NONE);
+    let s = sample(|| {
+        let expr = Parser::from_bytes(EXPR).parse_arithm_expr().unwrap();
+        let mut result = 0;
+        assert!(unsafe { sys::mrsh_run_arithm_expr(state.as_ptr(), expr.as_ptr(), &mut result) });
+    });
+    report("parse + walk", &s, None);
+
+    state.env_set("i", "0", sys::MRSH_VAR_ATTRIB_NONE);
+    let expr = ArithmExpr::parse(EXPR).unwrap();
+    let s = sample(|| {
+        let mut result = 0;
+        assert!(unsafe { sys::mrsh_run_arithm_expr(state.as_ptr(), expr.as_ptr(), &mut result) });
+    });
+    report("walk", &s, None);
+
+    state.env_set("i", "0", sys::MRSH_VAR_ATTRIB_NONE);
+    let compiled = CompiledArithm::compile(&expr);
+    let s = sample(|| {
+        compiled.eval(&mut state).unwrap();
+    });
+    report("bytecode", &s, None);
+
+    // The same counter as a shell loop, for reference: the loop's own
+    // `i=$((i + 1))` is the only work per iteration
+    let iters = 100_000;
+    bench_loop(&mut state, "shell loop", "", iters, ":");
+    assert_eq!(state.env_get("i"), Some(iters.to_string()));
+}
@@ -0,0 +1,39 @@
+//! Scaling of parse_batch from 1 to 64 threads.
+
+mod common;
+
+use common::{report, sample};
+use mrsh::parse_batch;
+
+fn script(i: usize) -> String {
+    let mut s = String::new();
+    for j in 0..(20 + i % 80) {
+        s += &format!(
+            "f_{i}_{j}() {{\n\tfor x in \"$@\"; do\n\t\tcase $x in\n\t\t-v) v=$((v + 1)) ;;\n\t\t*) printf '%s\\n' \"${{x%%.*}}\" >> \"$OUT\" ;;\n\t\tesac\n\tdone\n}}\n",
+            i = i,
+            j = j
+        );
+    }
+    s
+}
+
+fn main() {
+    let corpus = (0..2000).map(script).collect::<Vec<_>>();
+    let bytes: usize = corpus.iter().map(String::len).sum();
+    println!("{} scripts, {} bytes", corpus.len(), bytes);
+
+    let mut base = None;
+    for &threads in &[1, 2, 4, 8, 16, 32, 64] {
+        let s = sample(|| {
+            let parsed = parse_batch(&corpus, threads);
+            assert!(parsed.iter().all(Result::is_ok));
+        });
+        let secs = s.per_iter().as_secs_f64();
+        let base = *base.get_or_insert(secs);
+        report(
+            &format!("{} threads, {:.2}x", threads, base / secs),
+            &s,
+            Some(bytes),
+        );
+    }
+}
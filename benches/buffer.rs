@@ -0,0 +1,59 @@
+//! Growing an mrsh_buffer piece by piece, as expansion and command
+//! substitution do, and capturing large `$(...)` output.
+
+mod common;
+
+use std::env;
+use std::fs;
+use std::os::raw::c_char;
+
+use common::{bench_state, report, sample};
+use mrsh::{sys, Program};
+
+const PIECE: &[u8; 64] = b"0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ.\n";
+
+fn append(size: usize, reserve: bool) {
+    let mut buf: sys::mrsh_buffer = unsafe { std::mem::zeroed() };
+    unsafe {
+        if reserve {
+            sys::mrsh_buffer_reserve(&mut buf, size);
+        }
+        for _ in 0..size / PIECE.len() {
+            assert!(sys::mrsh_buffer_append(
+                &mut buf,
+                PIECE.as_ptr() as *const c_char,
+                PIECE.len()
+            ));
+        }
+        libc::free(sys::mrsh_buffer_steal(&mut buf).cast());
+    }
+}
+
+fn main() {
+    for &size in &[64 * 1024, 1024 * 1024, 16 * 1024 * 1024] {
+        let s = sample(|| append(size, false));
+        report(&format!("append {} KiB", size / 1024), &s, Some(size));
+        let s = sample(|| append(size, true));
+        report(
+            &format!("append {} KiB reserved", size / 1024),
+            &s,
+            Some(size),
+        );
+    }
+
+    let mut state = bench_state();
+    let length = Program::parse(b"n=${#x}").unwrap();
+    let path = env::temp_dir().join(format!("mrsh-bench-buffer-{}", std::process::id()));
+    for &size in &[64 * 1024, 1024 * 1024, 16 * 1024 * 1024] {
+        fs::write(&path, PIECE.repeat(size / PIECE.len())).unwrap();
+        let prog = Program::parse(format!("x=$(cat '{}')", path.display()).as_bytes()).unwrap();
+        let s = sample(|| {
+            assert_eq!(state.run_program(&prog), 0);
+        });
+        report(&format!("$(cat) {} KiB", size / 1024), &s, Some(size));
+        // The trailing newline is stripped
+        assert_eq!(state.run_program(&length), 0);
+        assert_eq!(state.env_get("n").unwrap(), (size - 1).to_string());
+    }
+    fs::remove_file(&path).unwrap();
+}
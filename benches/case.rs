@@ -0,0 +1,57 @@
+//! `case` dispatch with 10, 100 and 1000 arms: the shell matching each
+//! pattern in turn, against the compiled matcher.
+
+mod common;
+
+use common::{bench_state, report, sample};
+use mrsh::{sys, CompiledCase, Program};
+
+/// Mostly literal arms, with a prefix glob every tenth arm and a catch-all.
+fn script(arms: usize) -> String {
+    let mut s = String::from("case $w in\n");
+    for i in 0..arms {
+        if i % 10 == 9 {
+            s += &format!("pre_{}_*) r={} ;;\n", i, i);
+        } else {
+            s += &format!("cmd_{}) r={} ;;\n", i, i);
+        }
+    }
+    s += "*) r=miss ;;\nesac\n";
+    s
+}
+
+fn case_clause(prog: &Program) -> &sys::mrsh_case_clause {
+    unsafe {
+        let l = prog.body()[0];
+        let pl = sys::mrsh_and_or_list_get_pipeline((*l).and_or_list);
+        let cmd = *((*pl).commands.data as *const *const sys::mrsh_command);
+        &*sys::mrsh_command_get_case_clause(cmd)
+    }
+}
+
+fn main() {
+    let mut state = bench_state();
+    for &arms in &[10, 100, 1000] {
+        let prog = Program::parse(script(arms).as_bytes()).unwrap();
+        let compiled = CompiledCase::compile(case_clause(&prog)).unwrap();
+
+        let words = [
+            ("first", "cmd_0".to_owned()),
+            ("last", format!("cmd_{}", arms - 2)),
+            ("glob", format!("pre_{}_x", arms - 1)),
+            ("miss", "none".to_owned()),
+        ];
+        for (name, word) in &words {
+            state.env_set("w", word, sys::MRSH_VAR_ATTRIB_NONE);
+            let s = sample(|| {
+                state.run_program(&prog);
+            });
+            report(&format!("shell {} arms {}", arms, name), &s, None);
+
+            let s = sample(|| {
+                assert!(compiled.find(word.as_bytes()).is_some());
+            });
+            report(&format!("compiled {} arms {}", arms, name), &s, None);
+        }
+    }
+}
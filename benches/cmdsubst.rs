@@ -0,0 +1,20 @@
+//! Cost of command substitutions whose body only runs builtins and shell
+//! functions, against the equivalent assignment without a substitution.
+
+mod common;
+
+use common::{bench_loop, bench_state};
+
+const ITERS: u32 = 2000;
+
+fn main() {
+    let mut state = bench_state();
+    state.env_set("PWD", "/", mrsh::sys::MRSH_VAR_ATTRIB_EXPORT);
+
+    let f = "f() { pwd; }";
+    bench_loop(&mut state, "x=$(pwd)", "", ITERS, "x=$(pwd)");
+    bench_loop(&mut state, "x=$PWD", "", ITERS, "x=$PWD");
+    bench_loop(&mut state, "n=$(f)", f, ITERS, "n=$(f)");
+    bench_loop(&mut state, "n=`f`", f, ITERS, "n=`f`");
+    bench_loop(&mut state, "f >/dev/null", f, ITERS, "f >/dev/null");
+}
@@ -0,0 +1,216 @@
+//! Shared bench harness: time-boxed sampling, allocation and process
+//! counting, and shell loops.
+//!
+//! Allocations are counted by interposing malloc, calloc and realloc in front
+//! of glibc's, so they include both libmrsh's and Rust's. Processes are
+//! counted the same way, by interposing fork, vfork, posix_spawn and
+//! posix_spawnp. Elsewhere both counts are reported as zero.
+
+#![allow(dead_code)]
+
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::time::{Duration, Instant};
+
+use mrsh::{sys, Program, State};
+
+static ALLOCS: AtomicU64 = AtomicU64::new(0);
+static FORKS: AtomicU64 = AtomicU64::new(0);
+
+#[cfg(all(target_os = "linux", target_env = "gnu"))]
+mod interpose {
+    use super::{ALLOCS, FORKS};
+    use std::os::raw::{c_char, c_int, c_void};
+    use std::sync::atomic::Ordering;
+
+    extern "C" {
+        fn __libc_malloc(size: usize) -> *mut c_void;
+        fn __libc_calloc(n: usize, size: usize) -> *mut c_void;
+        fn __libc_realloc(ptr: *mut c_void, size: usize) -> *mut c_void;
+    }
+
+    #[no_mangle]
+    pub unsafe extern "C" fn malloc(size: usize) -> *mut c_void {
+        ALLOCS.fetch_add(1, Ordering::Relaxed);
+        __libc_malloc(size)
+    }
+
+    #[no_mangle]
+    pub unsafe extern "C" fn calloc(n: usize, size: usize) -> *mut c_void {
+        ALLOCS.fetch_add(1, Ordering::Relaxed);
+        __libc_calloc(n, size)
+    }
+
+    #[no_mangle]
+    pub unsafe extern "C" fn realloc(ptr: *mut c_void, size: usize) -> *mut c_void {
+        ALLOCS.fetch_add(1, Ordering::Relaxed);
+        __libc_realloc(ptr, size)
+    }
+
+    /// The next definition of `name`, i.e. glibc's.
+    unsafe fn next(name: &[u8]) -> *mut c_void {
+        let f = libc::dlsym(libc::RTLD_NEXT, name.as_ptr().cast());
+        assert!(!f.is_null(), "dlsym failed");
+        f
+    }
+
+    #[no_mangle]
+    pub unsafe extern "C" fn fork() -> libc::pid_t {
+        FORKS.fetch_add(1, Ordering::Relaxed);
+        let fork: extern "C" fn() -> libc::pid_t = std::mem::transmute(next(b"fork\0"));
+        fork()
+    }
+
+    // Callers of vfork may not return from the function that called it, so
+    // this falls back to a plain fork
+    #[no_mangle]
+    pub unsafe extern "C" fn vfork() -> libc::pid_t {
+        fork()
+    }
+
+    type SpawnFn = unsafe extern "C" fn(
+        *mut libc::pid_t,
+        *const c_char,
+        *const libc::posix_spawn_file_actions_t,
+        *const libc::posix_spawnattr_t,
+        *const *mut c_char,
+        *const *mut c_char,
+    ) -> c_int;
+
+    #[no_mangle]
+    pub unsafe extern "C" fn posix_spawn(
+        pid: *mut libc::pid_t,
+        path: *const c_char,
+        file_actions: *const libc::posix_spawn_file_actions_t,
+        attrp: *const libc::posix_spawnattr_t,
+        argv: *const *mut c_char,
+        envp: *const *mut c_char,
+    ) -> c_int {
+        FORKS.fetch_add(1, Ordering::Relaxed);
+        let spawn: SpawnFn = std::mem::transmute(next(b"posix_spawn\0"));
+        spawn(pid, path, file_actions, attrp, argv, envp)
+    }
+
+    #[no_mangle]
+    pub unsafe extern "C" fn posix_spawnp(
+        pid: *mut libc::pid_t,
+        file: *const c_char,
+        file_actions: *const libc::posix_spawn_file_actions_t,
+        attrp: *const libc::posix_spawnattr_t,
+        argv: *const *mut c_char,
+        envp: *const *mut c_char,
+    ) -> c_int {
+        FORKS.fetch_add(1, Ordering::Relaxed);
+        let spawn: SpawnFn = std::mem::transmute(next(b"posix_spawnp\0"));
+        spawn(pid, file, file_actions, attrp, argv, envp)
+    }
+}
+
+pub fn allocs() -> u64 {
+    ALLOCS.load(Ordering::Relaxed)
+}
+
+/// Processes started by this process so far.
+pub fn forks() -> u64 {
+    FORKS.load(Ordering::Relaxed)
+}
+
+/// How long each benchmark samples for, from MRSH_BENCH_SECS (default 1).
+pub fn duration() -> Duration {
+    let secs = std::env::var("MRSH_BENCH_SECS")
+        .ok()
+        .and_then(|v| v.parse().ok())
+        .unwrap_or(1.0);
+    Duration::from_secs_f64(secs)
+}
+
+pub struct Sample {
+    pub iters: u64,
+    pub elapsed: Duration,
+    pub allocs: u64,
+    pub forks: u64,
+}
+
+impl Sample {
+    pub fn per_iter(&self) -> Duration {
+        Duration::from_secs_f64(self.elapsed.as_secs_f64() / self.iters as f64)
+    }
+}
+
+/// Run `f` repeatedly for `duration()`, after one warm-up call.
+pub fn sample<F: FnMut()>(mut f: F) -> Sample {
+    f();
+    let limit = duration();
+    let allocs = allocs();
+    let forks = forks();
+    let start = Instant::now();
+    let mut iters = 0;
+    while iters == 0 || start.elapsed() < limit {
+        f();
+        iters += 1;
+    }
+    Sample {
+        iters,
+        elapsed: start.elapsed(),
+        allocs: self::allocs() - allocs,
+        forks: self::forks() - forks,
+    }
+}
+
+/// Print one result line. `bytes` is the amount of input processed per
+/// iteration, if throughput makes sense.
+pub fn report(name: &str, s: &Sample, bytes: Option<usize>) {
+    let throughput = match bytes {
+        Some(bytes) => format!(
+            "{:>9.1} MiB/s",
+            bytes as f64 * s.iters as f64 / s.elapsed.as_secs_f64() / (1024.0 * 1024.0)
+        ),
+        None => String::new(),
+    };
+    println!(
+        "{:<32} {:>9} iters {:>12.2?}/iter {:>10.1} allocs/iter {:>6.2} forks/iter {}",
+        name,
+        s.iters,
+        s.per_iter(),
+        s.allocs as f64 / s.iters as f64,
+        s.forks as f64 / s.iters as f64,
+        throughput
+    );
+}
+
+/// A shell state for benches. `State::new` doesn't import the environment, so
+/// PATH is set here, from ours or to a default, for benches that run
+/// external programs.
+pub fn bench_state() -> State {
+    let mut state = State::new();
+    let path = std::env::var("PATH").unwrap_or_else(|_| "/usr/local/bin:/usr/bin:/bin".to_owned());
+    state.env_set("PATH", &path, sys::MRSH_VAR_ATTRIB_EXPORT);
+    state
+}
+
+/// A script that runs `body` `iters` times. The loop counter is `$i`, counted
+/// with builtins only so that the loop itself doesn't fork.
+pub fn loop_script(iters: u32, body: &str) -> String {
+    format!(
+        "i=0; while case $i in {}) false;; *) true;; esac; do {}; i=$((i + 1)); done",
+        iters, body
+    )
+}
+
+/// Run `setup` once, then sample a shell loop of `iters` iterations of
+/// `body` and report the cost per loop iteration.
+pub fn bench_loop(state: &mut State, name: &str, setup: &str, iters: u32, body: &str) -> Sample {
+    if !setup.is_empty() {
+        let setup = Program::parse(setup.as_bytes()).unwrap();
+        state.run_program(&setup);
+    }
+    let prog = Program::parse(loop_script(iters, body).as_bytes()).unwrap();
+    let s = sample(|| {
+        state.run_program(&prog);
+    });
+    let s = Sample {
+        iters: s.iters * iters as u64,
+        ..s
+    };
+    report(name, &s, None);
+    s
+}
@@ -0,0 +1,92 @@
+#!/bin/sh
+# Probe the toolchain and write config.mk, in the style of a handwritten
+# configure script
+
+prefix=/usr/local
+bindir='$(PREFIX)/bin'
+debug=no
+features=
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2}
+
+usage() {
+	cat <<END
+usage: ./configure [options]
+
+  --prefix=DIR       install under DIR [$prefix]
+  --bindir=DIR       install binaries under DIR [$bindir]
+  --enable-debug     build with debug information
+  --with-FEATURE     enable an optional feature
+END
+	exit 0
+}
+
+for arg; do
+	case $arg in
+	--prefix=*) prefix=${arg#*=} ;;
+	--bindir=*) bindir=${arg#*=} ;;
+	--enable-debug) debug=yes ;;
+	--with-*) features="$features ${arg#--with-}" ;;
+	-h|--help) usage ;;
+	*)
+		printf 'unknown option: %s\n' "$arg" >&2
+		exit 1
+		;;
+	esac
+done
+
+tmp=$(mktemp -d 2>/dev/null || echo "/tmp/configure.$$")
+trap 'rm -rf "$tmp"' EXIT INT TERM
+mkdir -p "$tmp"
+
+try_cc() {
+	printf '%s\n' "$1" > "$tmp/test.c"
+	$CC $CFLAGS $2 -o "$tmp/test" "$tmp/test.c" > /dev/null 2>&1
+}
+
+check() {
+	printf 'checking %s... ' "$1"
+	if try_cc "$2" "$3"; then
+		echo yes
+		return 0
+	fi
+	echo no
+	return 1
+}
+
+check "whether $CC works" 'int main(void) { return 0; }' || {
+	echo "error: no working C compiler" >&2
+	exit 1
+}
+
+flags=
+for flag in -Wall -Wextra -Wno-unused-parameter -std=c11; do
+	if check "for $flag" 'int main(void) { return 0; }' "$flag"; then
+		flags="$flags $flag"
+	fi
+done
+
+if check "for strlcpy" '#include <string.h>
+int main(void) { char b[4]; return (int)strlcpy(b, "x", sizeof(b)); }'; then
+	flags="$flags -DHAVE_STRLCPY"
+fi
+
+if [ "$debug" = yes ]; then
+	CFLAGS="$CFLAGS -g"
+fi
+
+n=0
+for feature in $features; do
+	upper=$(echo "$feature" | tr 'a-z-' 'A-Z_')
+	flags="$flags -DWITH_$upper"
+	n=$((n + 1))
+done
+
+{
+	echo "PREFIX = $prefix"
+	echo "BINDIR = $bindir"
+	echo "CC = $CC"
+	echo "CFLAGS = $CFLAGS$flags"
+} > config.mk
+
+echo "wrote config.mk ($n optional features)"
@@ -0,0 +1,81 @@
+#!/bin/sh
+# Roll out a release to a set of hosts
+set -eu
+
+RELEASE=${1:?usage: deploy.sh release [hosts...]}
+shift
+HOSTS=${*:-"web1 web2 web3"}
+STAGE=${STAGE:-production}
+ROOT=/srv/app
+LOG=${TMPDIR:-/tmp}/deploy-$RELEASE.log
+
+die() {
+	echo "error: $*" >&2
+	exit 1
+}
+
+remote() {
+	host=$1
+	shift
+	ssh -o BatchMode=yes "deploy@$host" "$@"
+}
+
+render_config() {
+	cat <<END
+release=$RELEASE
+stage=$STAGE
+root=$ROOT/releases/$RELEASE
+started=$(date +%s)
+END
+}
+
+upload() {
+	host=$1
+	archive=app-$RELEASE.tar.gz
+	[ -f "dist/$archive" ] || die "dist/$archive not found"
+	scp -q "dist/$archive" "deploy@$host:$ROOT/incoming/" >> "$LOG" 2>&1
+	render_config | remote "$host" "cat > $ROOT/incoming/release.conf"
+}
+
+activate() {
+	host=$1
+	remote "$host" "
+		set -e
+		mkdir -p $ROOT/releases/$RELEASE
+		tar -xzf $ROOT/incoming/app-$RELEASE.tar.gz -C $ROOT/releases/$RELEASE
+		ln -sfn $ROOT/releases/$RELEASE $ROOT/current
+	"
+}
+
+prune() {
+	host=$1
+	keep=${KEEP:-5}
+	remote "$host" "ls -1t $ROOT/releases" | {
+		n=0
+		while read -r old; do
+			n=$((n + 1))
+			if [ "$n" -gt "$keep" ]; then
+				remote "$host" "rm -rf '$ROOT/releases/$old'"
+			fi
+		done
+	}
+}
+
+failed=
+for host in $HOSTS; do
+	case $host in
+	*.*) fqdn=$host ;;
+	*) fqdn=$host.${DOMAIN:-example.com} ;;
+	esac
+	echo "==> $fqdn"
+	if upload "$fqdn" && activate "$fqdn"; then
+		prune "$fqdn" || echo "warning: pruning failed on $fqdn" >&2
+	else
+		failed="$failed $fqdn"
+	fi
+done
+
+if [ -n "$failed" ]; then
+	die "deployment failed on:$failed (see $LOG)"
+fi
+echo "deployed $RELEASE to $(echo $HOSTS | wc -w) hosts"
@@ -0,0 +1,94 @@
+#!/bin/sh
+# Start, stop and supervise a daemon, in the style of an init script
+
+NAME=exampled
+DAEMON=/usr/sbin/$NAME
+PIDFILE=/run/$NAME.pid
+CONFIG=${CONFIG:-/etc/$NAME.conf}
+RETRIES=5
+
+log() {
+	printf '%s: %s\n' "$NAME" "$*" >&2
+}
+
+read_pid() {
+	pid=
+	if [ -r "$PIDFILE" ]; then
+		read -r pid < "$PIDFILE" || pid=
+	fi
+	case $pid in
+	''|*[!0-9]*) return 1 ;;
+	esac
+	return 0
+}
+
+is_running() {
+	read_pid && kill -0 "$pid" 2>/dev/null
+}
+
+check_config() {
+	if [ ! -f "$CONFIG" ]; then
+		log "missing configuration file $CONFIG"
+		return 1
+	fi
+	while IFS='=' read -r key value; do
+		case $key in
+		'#'*|'') continue ;;
+		port) PORT=$value ;;
+		user) RUN_AS=$value ;;
+		workers) WORKERS=$((value > 0 ? value : 1)) ;;
+		*) log "unknown option: $key" ;;
+		esac
+	done < "$CONFIG"
+}
+
+start() {
+	if is_running; then
+		log "already running (pid $pid)"
+		return 0
+	fi
+	check_config || return 1
+	log "starting on port ${PORT:-8080} with ${WORKERS:-1} workers"
+	"$DAEMON" --port "${PORT:-8080}" --workers "${WORKERS:-1}" &
+	echo $! > "$PIDFILE"
+}
+
+stop() {
+	if ! is_running; then
+		log "not running"
+		rm -f "$PIDFILE"
+		return 0
+	fi
+	kill "$pid"
+	n=0
+	while [ $n -lt $RETRIES ] && kill -0 "$pid" 2>/dev/null; do
+		sleep 1
+		n=$((n + 1))
+	done
+	if kill -0 "$pid" 2>/dev/null; then
+		log "did not stop after $RETRIES seconds, killing"
+		kill -9 "$pid"
+	fi
+	rm -f "$PIDFILE"
+}
+
+case "$1" in
+start) start ;;
+stop) stop ;;
+restart)
+	stop
+	start
+	;;
+status)
+	if is_running; then
+		echo "$NAME is running (pid $pid)"
+	else
+		echo "$NAME is stopped"
+		exit 3
+	fi
+	;;
+*)
+	echo "usage: $0 {start|stop|restart|status}" >&2
+	exit 2
+	;;
+esac
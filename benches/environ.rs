@@ -0,0 +1,39 @@
+//! Cost of launching an external utility as the exported environment grows,
+//! with and without a prefix assignment on the command. The environment is
+//! rebuilt from the variable table before every exec.
+
+mod common;
+
+use common::{bench_loop, bench_state};
+use mrsh::{sys, State};
+
+const COMMANDS: u32 = 500;
+
+fn bench(state: &mut State, vars: usize, name: &str, command: &str) {
+    bench_loop(
+        state,
+        &format!("{} vars, {}", vars, name),
+        "",
+        COMMANDS,
+        command,
+    );
+}
+
+fn main() {
+    let mut state = bench_state();
+    let mut exported = 0;
+    for &vars in &[0, 100, 500, 2000] {
+        while exported < vars {
+            state.env_set(
+                &format!("CI_VAR_{}", exported),
+                &format!("/builds/project/job-{}/artifacts", exported),
+                sys::MRSH_VAR_ATTRIB_EXPORT,
+            );
+            exported += 1;
+        }
+        bench(&mut state, vars, "/bin/true", "/bin/true");
+        bench(&mut state, vars, "X=1 /bin/true", "X=1 /bin/true");
+        // The same loop with a builtin, to subtract the shell's own cost
+        bench(&mut state, vars, ":", ":");
+    }
+}
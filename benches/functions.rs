@@ -0,0 +1,55 @@
+//! Calls to small shell functions: plain calls, calls with arguments,
+//! forwarding "$@" down a chain of calls, and `shift` over many positional
+//! parameters.
+
+mod common;
+
+use common::{bench_loop, bench_state, report, sample, Sample};
+use mrsh::Program;
+
+const ITERS: u32 = 20_000;
+
+const SHIFTS: u32 = 10_000;
+
+fn args(n: u32) -> String {
+    (0..n).map(|i| format!("arg{} ", i)).collect()
+}
+
+fn main() {
+    let mut state = bench_state();
+
+    bench_loop(&mut state, "no call", "", ITERS, ":");
+    bench_loop(&mut state, "f", "f() { :; }", ITERS, "f");
+    bench_loop(&mut state, "f a b c", "f() { :; }", ITERS, "f a b c");
+    for &n in &[10, 100] {
+        bench_loop(
+            &mut state,
+            &format!("3-deep \"$@\" x{}", n),
+            "f() { g \"$@\"; }; g() { h \"$@\"; }; h() { :; }",
+            ITERS,
+            &format!("f {}", args(n)),
+        );
+    }
+    // 100 helpers defined, so lookups by name go through a fuller table
+    let helpers: String = (0..100)
+        .map(|i| format!("helper_{}() {{ :; }}\n", i))
+        .collect();
+    bench_loop(&mut state, "f, 100 functions", &helpers, ITERS, "helper_50");
+
+    let prog = Program::parse(
+        format!(
+            "s() {{ while case $# in 0) false;; *) true;; esac; do shift; done; }}\ns {}",
+            args(SHIFTS)
+        )
+        .as_bytes(),
+    )
+    .unwrap();
+    let s = sample(|| {
+        state.run_program(&prog);
+    });
+    let s = Sample {
+        iters: s.iters * SHIFTS as u64,
+        ..s
+    };
+    report("shift", &s, None);
+}
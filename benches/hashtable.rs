@@ -0,0 +1,140 @@
+//! Measures mrsh_hashtable against an open-addressing table with SIMD group
+//! probing (std's HashMap) at 100, 10k and 1M keys.
+//!
+//! Every case is sampled, and reported per key. Filling a table is measured
+//! together with freeing it, and deleting together with filling the table
+//! again, so that each sample starts from the same state.
+
+mod common;
+
+use std::collections::HashMap;
+use std::ffi::CString;
+use std::os::raw::c_void;
+
+use common::{report, sample, Sample};
+use mrsh::sys;
+
+/// Lookups are sampled so that the 1M-key run stays reasonably short.
+const MAX_LOOKUPS: usize = 100_000;
+
+/// Report `s` per operation, for `ops` operations per sample.
+fn report_per_op(table: &str, op: &str, n: usize, ops: usize, s: Sample) {
+    let s = Sample {
+        iters: s.iters * ops as u64,
+        ..s
+    };
+    report(&format!("{} {} keys {}", table, n, op), &s, None);
+}
+
+fn keys(n: usize) -> Vec<CString> {
+    (0..n)
+        .map(|i| CString::new(format!("VAR_{}", i)).unwrap())
+        .collect()
+}
+
+fn missing_keys(n: usize) -> Vec<CString> {
+    (0..n.min(MAX_LOOKUPS))
+        .map(|i| CString::new(format!("MISSING_{}", i)).unwrap())
+        .collect()
+}
+
+fn lookups(keys: &[CString]) -> impl Iterator<Item = &CString> {
+    let step = (keys.len() / MAX_LOOKUPS).max(1);
+    keys.iter().step_by(step)
+}
+
+fn mrsh_fill(table: &mut sys::mrsh_hashtable, keys: &[CString]) {
+    for (i, key) in keys.iter().enumerate() {
+        unsafe { sys::mrsh_hashtable_set(table, key.as_ptr(), (i + 1) as *mut c_void) };
+    }
+}
+
+fn bench_mrsh(n: usize) {
+    let keys = keys(n);
+    let missing = missing_keys(n);
+    let mut table: Box<sys::mrsh_hashtable> = Box::new(unsafe { std::mem::zeroed() });
+
+    let s = sample(|| {
+        mrsh_fill(&mut table, &keys);
+        unsafe { sys::mrsh_hashtable_finish(&mut *table) };
+        *table = unsafe { std::mem::zeroed() };
+    });
+    report_per_op("mrsh_hashtable", "set+free", n, n, s);
+
+    mrsh_fill(&mut table, &keys);
+    let ops = lookups(&keys).count();
+    let s = sample(|| {
+        for key in lookups(&keys) {
+            let v = unsafe { sys::mrsh_hashtable_get(&mut *table, key.as_ptr()) };
+            assert!(!v.is_null());
+        }
+    });
+    report_per_op("mrsh_hashtable", "get", n, ops, s);
+
+    let s = sample(|| {
+        for key in &missing {
+            let v = unsafe { sys::mrsh_hashtable_get(&mut *table, key.as_ptr()) };
+            assert!(v.is_null());
+        }
+    });
+    report_per_op("mrsh_hashtable", "get miss", n, missing.len(), s);
+
+    let s = sample(|| {
+        mrsh_fill(&mut table, &keys);
+        for key in &keys {
+            unsafe { sys::mrsh_hashtable_del(&mut *table, key.as_ptr()) };
+        }
+    });
+    report_per_op("mrsh_hashtable", "set+del", n, n, s);
+
+    unsafe { sys::mrsh_hashtable_finish(&mut *table) };
+}
+
+fn std_fill(table: &mut HashMap<Box<[u8]>, usize>, keys: &[CString]) {
+    for (i, key) in keys.iter().enumerate() {
+        table.insert(key.as_bytes().into(), i + 1);
+    }
+}
+
+fn bench_std(n: usize) {
+    let keys = keys(n);
+    let missing = missing_keys(n);
+
+    let s = sample(|| {
+        let mut table = HashMap::new();
+        std_fill(&mut table, &keys);
+    });
+    report_per_op("std HashMap", "set+free", n, n, s);
+
+    let mut table = HashMap::new();
+    std_fill(&mut table, &keys);
+    let ops = lookups(&keys).count();
+    let s = sample(|| {
+        for key in lookups(&keys) {
+            assert!(table.contains_key(key.as_bytes()));
+        }
+    });
+    report_per_op("std HashMap", "get", n, ops, s);
+
+    let s = sample(|| {
+        for key in &missing {
+            assert!(!table.contains_key(key.as_bytes()));
+        }
+    });
+    report_per_op("std HashMap", "get miss", n, missing.len(), s);
+
+    let s = sample(|| {
+        std_fill(&mut table, &keys);
+        for key in &keys {
+            table.remove(key.as_bytes());
+        }
+    });
+    report_per_op("std HashMap", "set+del", n, n, s);
+}
+
+fn main() {
+    for &n in &[100, 10_000, 1_000_000] {
+        bench_mrsh(n);
+        bench_std(n);
+    }
+}
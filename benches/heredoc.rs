@@ -0,0 +1,98 @@
+//! Latency and peak RSS of running a here-document into
+//! `cat >/dev/null`, against the size of its body. Sizes double from
+//! 4 KiB up to MRSH_BENCH_MAX_HEREDOC_MIB (default 64), so they cross the
+//! 64 KiB pipe capacity.
+//!
+//! Peak RSS only ever grows, so sizes are run in increasing order and the
+//! growth of the shell's peak during each run is reported, next to the
+//! largest peak of a child so far. A case that doesn't finish within
+//! `TIMEOUT` is reported as a deadlock and ends the bench.
+
+mod common;
+
+use std::mem;
+use std::process;
+use std::sync::mpsc;
+use std::thread;
+use std::time::{Duration, Instant};
+
+use common::bench_state;
+use mrsh::{sys, Program};
+
+const TIMEOUT: Duration = Duration::from_secs(60);
+
+/// Peak RSS of this process, or of its largest reaped child.
+fn max_rss_kib(who: libc::c_int) -> libc::c_long {
+    let mut usage: libc::rusage = unsafe { mem::zeroed() };
+    unsafe { libc::getrusage(who, &mut usage) };
+    usage.ru_maxrss
+}
+
+/// A base64-looking payload of `size` bytes, as 76-column lines. If
+/// `expand` is set, every line references a variable.
+fn script(size: usize, expand: bool) -> String {
+    let delim = if expand { "EOF" } else { "'EOF'" };
+    let mut s = format!("cat >/dev/null <<{}\n", delim);
+    let line = if expand {
+        "QUJDREVGR0hJSktMTU5PUFFSU1RVVldYWVphYmNkZWZnaGlqa2xtbm9wcXJzdHV2d3h5ejAx$v\n"
+    } else {
+        "QUJDREVGR0hJSktMTU5PUFFSU1RVVldYWVphYmNkZWZnaGlqa2xtbm9wcXJzdHV2d3h5ejAxMjM0\n"
+    };
+    let mut body = 0;
+    while body < size {
+        s += line;
+        body += line.len();
+    }
+    s += "EOF\n";
+    s
+}
+
+fn main() {
+    let max_mib: usize = std::env::var("MRSH_BENCH_MAX_HEREDOC_MIB")
+        .ok()
+        .and_then(|v| v.parse().ok())
+        .unwrap_or(64);
+
+    let mut state = bench_state();
+    state.env_set("v", "MjM0", sys::MRSH_VAR_ATTRIB_NONE);
+
+    let mut size = 4 * 1024;
+    while size <= max_mib * 1024 * 1024 {
+        for &expand in &[false, true] {
+            let name = format!(
+                "{:>8} KiB {:<8}",
+                size / 1024,
+                if expand { "expanded" } else { "quoted" }
+            );
+            let prog = Program::parse(script(size, expand).as_bytes()).unwrap();
+
+            // The shell can't be interrupted, so a stuck case ends the
+            // process
+            let (done, finished) = mpsc::channel::<()>();
+            let watchdog = {
+                let name = name.clone();
+                thread::spawn(move || {
+                    if let Err(mpsc::RecvTimeoutError::Timeout) = finished.recv_timeout(TIMEOUT) {
+                        println!("{} deadlock: not done after {:?}", name, TIMEOUT);
+                        process::exit(1);
+                    }
+                })
+            };
+
+            let rss = max_rss_kib(libc::RUSAGE_SELF);
+            let start = Instant::now();
+            assert_eq!(state.run_program(&prog), 0);
+            let ms = start.elapsed().as_secs_f64() * 1e3;
+            done.send(()).unwrap();
+            watchdog.join().unwrap();
+            println!(
+                "{} {:>10.2} ms {:>10} KiB peak RSS growth {:>10} KiB child peak RSS",
+                name,
+                ms,
+                max_rss_kib(libc::RUSAGE_SELF) - rss,
+                max_rss_kib(libc::RUSAGE_CHILDREN)
+            );
+        }
+        size *= 2;
+    }
+}
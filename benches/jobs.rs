@@ -0,0 +1,48 @@
+//! Launching and reaping background jobs: N `/bin/true &` followed by `wait`,
+//! for N up to MRSH_BENCH_MAX_JOBS (default 10000). Time per job should stay
+//! flat as N grows; context switches of the shell stand in for wakeups.
+
+mod common;
+
+use std::mem;
+
+use common::{bench_state, loop_script, report, sample, Sample};
+use mrsh::{sys, Program};
+
+fn context_switches() -> libc::c_long {
+    let mut usage: libc::rusage = unsafe { mem::zeroed() };
+    unsafe { libc::getrusage(libc::RUSAGE_SELF, &mut usage) };
+    usage.ru_nvcsw + usage.ru_nivcsw
+}
+
+fn main() {
+    let max_jobs: u32 = std::env::var("MRSH_BENCH_MAX_JOBS")
+        .ok()
+        .and_then(|v| v.parse().ok())
+        .unwrap_or(10_000);
+
+    let wait = Program::parse(b"wait").unwrap();
+    let mut state = bench_state();
+    let mut jobs = 100;
+    while jobs <= max_jobs {
+        let launch = Program::parse(loop_script(jobs, "/bin/true &").as_bytes()).unwrap();
+        let (mut runs, mut switches) = (0, 0);
+        let s = sample(|| {
+            let before = context_switches();
+            state.run_program(&launch);
+            state.run_program(&wait);
+            // Otherwise finished jobs pile up in the state, and later
+            // samples pay for the earlier ones
+            unsafe { sys::mrsh_destroy_terminated_jobs(state.as_ptr()) };
+            switches += context_switches() - before;
+            runs += 1;
+        });
+        let cs = switches as f64 / (runs as f64 * jobs as f64);
+        let s = Sample {
+            iters: s.iters * jobs as u64,
+            ..s
+        };
+        report(&format!("{} jobs, {:.1} cs/job", jobs, cs), &s, None);
+        jobs *= 10;
+    }
+}
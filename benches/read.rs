@@ -0,0 +1,89 @@
+//! `while read` over a large file, redirected from the file and through a
+//! pipe, against a buffered line count in Rust as a lower bound.
+//!
+//! The file size is MRSH_BENCH_READ_MIB (default 32). At one read(2) per
+//! byte, each shell loop over the default takes several seconds.
+
+mod common;
+
+use std::env;
+use std::fs::{self, File};
+use std::io::{BufRead, BufReader, BufWriter, Write};
+use std::path::PathBuf;
+
+use common::{bench_state, report, sample};
+use mrsh::{Program, State};
+
+/// A file in the temporary directory, removed when dropped, so that it is
+/// also removed when a run fails.
+struct TempFile(PathBuf);
+
+impl TempFile {
+    fn new(size: usize) -> TempFile {
+        let file =
+            TempFile(env::temp_dir().join(format!("mrsh-bench-read-{}", std::process::id())));
+        let mut w = BufWriter::new(File::create(&file.0).unwrap());
+        let mut written = 0;
+        let mut i = 0u64;
+        while written < size {
+            let line = format!(
+                "{:08} host-{:04} status=ok latency={}ms\n",
+                i,
+                i % 9973,
+                i % 500
+            );
+            w.write_all(line.as_bytes()).unwrap();
+            written += line.len();
+            i += 1;
+        }
+        w.flush().unwrap();
+        file
+    }
+}
+
+impl Drop for TempFile {
+    fn drop(&mut self) {
+        let _ = fs::remove_file(&self.0);
+    }
+}
+
+fn run(state: &mut State, name: &str, script: &str, size: usize) {
+    let prog = Program::parse(script.as_bytes()).unwrap();
+    let s = sample(|| assert_eq!(state.run_program(&prog), 0));
+    report(name, &s, Some(size));
+}
+
+fn main() {
+    let mib = env::var("MRSH_BENCH_READ_MIB")
+        .ok()
+        .and_then(|v| v.parse().ok())
+        .unwrap_or(32);
+    let file = TempFile::new(mib * 1024 * 1024);
+    let size = fs::metadata(&file.0).unwrap().len() as usize;
+    println!("{}: {} bytes", file.0.display(), size);
+
+    let mut lines = 0;
+    let s = sample(|| lines = BufReader::new(File::open(&file.0).unwrap()).lines().count());
+    report("rust BufRead", &s, Some(size));
+    println!("{} lines", lines);
+
+    let mut state = bench_state();
+    let path = file.0.display();
+    // Both loops count lines, and fail unless they saw all of them
+    let count = format!(
+        "n=0; while read -r line; do n=$((n + 1)); done; case $n in {}) ;; *) false;; esac",
+        lines
+    );
+    run(
+        &mut state,
+        "read < file",
+        &format!("{{ {}; }} < '{}'", count, path),
+        size,
+    );
+    run(
+        &mut state,
+        "cat file | read",
+        &format!("cat '{}' | {{ {}; }}", path, count),
+        size,
+    );
+}
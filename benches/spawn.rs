@@ -0,0 +1,36 @@
+//! Latency of launching external utilities from mrsh_run_program as the host
+//! process grows. fork has to copy the page tables of the whole process, so
+//! the cost per command rises with the host's RSS. The forks/iter column
+//! counts the processes started per command, through fork, vfork or
+//! posix_spawn.
+//!
+//! Set MRSH_BENCH_MAX_RSS_MIB to change the largest host size (default 1024).
+
+mod common;
+
+use common::{bench_loop, bench_state};
+
+const COMMANDS: u32 = 500;
+
+fn main() {
+    let max_rss_mib: usize = std::env::var("MRSH_BENCH_MAX_RSS_MIB")
+        .ok()
+        .and_then(|v| v.parse().ok())
+        .unwrap_or(1024);
+
+    let mut state = bench_state();
+    let mut ballast: Vec<Vec<u8>> = Vec::new();
+    let mut rss_mib = 0;
+    loop {
+        let name = format!("/bin/true, {} MiB host", rss_mib);
+        bench_loop(&mut state, &name, "", COMMANDS, "/bin/true");
+
+        if rss_mib >= max_rss_mib {
+            break;
+        }
+        let grow = if rss_mib == 0 { 64 } else { rss_mib };
+        // Touch every page so that it is actually resident
+        ballast.push(vec![1; grow * 1024 * 1024]);
+        rss_mib += grow;
+    }
+}
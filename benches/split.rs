@@ -0,0 +1,73 @@
+//! Field splitting of 1 MiB expansions: default IFS, a custom IFS, command
+//! substitution output and forwarding of "$@".
+
+mod common;
+
+use std::env;
+use std::fs;
+
+use common::{bench_state, report, sample};
+use mrsh::{sys, Program, State};
+
+const SIZE: usize = 1024 * 1024;
+
+/// About 1 MiB of short words separated by spaces, tabs and newlines.
+fn words(sep: &[&str]) -> String {
+    let mut s = String::with_capacity(SIZE + 16);
+    let mut i = 0;
+    while s.len() < SIZE {
+        s += &format!("w{}{}", i % 10_000, sep[i % sep.len()]);
+        i += 1;
+    }
+    s
+}
+
+fn bench(state: &mut State, name: &str, src: &str) {
+    let prog = Program::parse(src.as_bytes()).unwrap();
+    let s = sample(|| {
+        assert_eq!(state.run_program(&prog), 0);
+    });
+    report(name, &s, Some(SIZE));
+}
+
+/// The number of positional parameters left by the last `set --`.
+fn fields(state: &mut State) -> usize {
+    let prog = Program::parse(b"n=$#").unwrap();
+    assert_eq!(state.run_program(&prog), 0);
+    state.env_get("n").unwrap().parse().unwrap()
+}
+
+fn main() {
+    let mut state = bench_state();
+
+    state.env_set(
+        "x",
+        &words(&[" ", " ", "\t", "\n"]),
+        sys::MRSH_VAR_ATTRIB_NONE,
+    );
+    state.env_set("p", &words(&[":"]), sys::MRSH_VAR_ATTRIB_NONE);
+
+    let x = state.env_get("x").unwrap();
+    let expected = x.split_ascii_whitespace().count();
+
+    bench(&mut state, "split default IFS", "set -- $x");
+    assert_eq!(fields(&mut state), expected);
+    bench(&mut state, "split IFS=:", "IFS=:; set -- $p; unset IFS");
+    bench(&mut state, "split for loop", "for w in $x; do :; done");
+
+    let path = env::temp_dir().join(format!("mrsh-bench-split-{}", std::process::id()));
+    fs::write(&path, &x).unwrap();
+    bench(
+        &mut state,
+        "split $(cat file)",
+        &format!("set -- $(cat '{}')", path.display()),
+    );
+    assert_eq!(fields(&mut state), expected);
+    fs::remove_file(&path).unwrap();
+
+    bench(
+        &mut state,
+        "forward \"$@\"",
+        "set -- $x; f() { g \"$@\"; }; g() { :; }; f \"$@\"",
+    );
+}
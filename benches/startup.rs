@@ -0,0 +1,71 @@
+//! Compares parsing a script from source against loading it from the
+//! ScriptCache.
+
+mod common;
+
+use std::fs;
+
+use common::{report, sample};
+use mrsh::{Program, ScriptCache};
+
+/// A deploy-script-like program with functions, loops, case dispatch,
+/// parameter expansions and here-documents.
+fn script(functions: usize) -> String {
+    let mut s = String::from("#!/bin/sh\nset -e\n");
+    for i in 0..functions {
+        s += &format!(
+            r#"
+step_{i}() {{
+	target="${{1:-default_{i}}}"
+	for host in $HOSTS; do
+		case "$host" in
+		web*) echo "deploying {i} to $host" >> "$LOG" ;;
+		db*|cache*) [ -n "$FORCE" ] && echo "skip $host" || continue ;;
+		*) printf '%s\n' "unknown host: $host" >&2 ;;
+		esac
+	done
+	n=$((n + {i} * 2))
+	if [ "$(uname -s)" = Linux ]; then
+		cat > "/tmp/step_{i}.conf" <<END
+name=$target
+index={i}
+END
+	fi
+}}
+"#,
+            i = i
+        );
+    }
+    s
+}
+
+fn main() {
+    let dir = std::env::temp_dir().join(format!("mrsh-bench-startup-{}", std::process::id()));
+    let cache = ScriptCache::new(&dir).unwrap();
+
+    for &functions in &[10, 100, 1000] {
+        let src = script(functions);
+        let src = src.as_bytes();
+        cache.parse(src).unwrap();
+        println!("{} functions, {} bytes of source", functions, src.len());
+
+        let s = sample(|| {
+            Program::parse(src).unwrap();
+        });
+        report(
+            &format!("cold parse, {} functions", functions),
+            &s,
+            Some(src.len()),
+        );
+        let s = sample(|| {
+            cache.load(src).unwrap();
+        });
+        report(
+            &format!("cache load, {} functions", functions),
+            &s,
+            Some(src.len()),
+        );
+    }
+
+    fs::remove_dir_all(&dir).unwrap();
+}
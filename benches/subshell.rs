@@ -0,0 +1,35 @@
+//! Cost of `( ... )` subshells whose body only runs builtins, shell
+//! functions and assignments, against the same body in a brace group, and
+//! against a subshell that has to fork anyway to run an external utility.
+
+mod common;
+
+use common::{bench_loop, bench_state};
+use mrsh::State;
+
+const ITERS: u32 = 2000;
+
+fn bench(state: &mut State, name: &str, setup: &str, body: &str) {
+    bench_loop(state, name, setup, ITERS, body);
+}
+
+fn main() {
+    let mut state = bench_state();
+    let f = "f() { x=$((x + 1)); }";
+
+    bench(&mut state, "(x=1)", "", "(x=1)");
+    bench(&mut state, "{ x=1; }", "", "{ x=1; }");
+    bench(&mut state, "(cd / && x=$PWD)", "", "(cd / && x=$PWD)");
+    bench(&mut state, "{ cd / && x=$PWD; }", "", "{ cd / && x=$PWD; }");
+    bench(&mut state, "(set -e; f)", f, "(set -e; f)");
+    bench(&mut state, "{ f; }", f, "{ f; }");
+    bench(
+        &mut state,
+        "(unset x; export y=1; f)",
+        f,
+        "(unset x; export y=1; f)",
+    );
+    // Needs a fork either way
+    bench(&mut state, "(/bin/true)", "", "(/bin/true)");
+    bench(&mut state, "/bin/true", "", "/bin/true");
+}
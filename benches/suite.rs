@@ -0,0 +1,191 @@
+//! Benchmark suite covering parsing, word expansion, arithmetic and
+//! end-to-end runs of loop-heavy and fork-heavy scripts. The variable hash
+//! table has its own bench, `hashtable`.
+//!
+//!     cargo bench --bench suite
+//!
+//! Environment:
+//!
+//! - MRSH_BENCH_SECS: sampling time per benchmark, in seconds (default 1)
+//! - MRSH_BENCH_CORPUS: directory of scripts to parse (default
+//!   benches/corpus)
+//! - MRSH_BENCH_DASH: dash binary to run the end-to-end scripts under as a
+//!   baseline (default `dash` from $PATH, skipped if missing)
+
+mod common;
+
+use std::fs;
+use std::path::PathBuf;
+use std::process::{Command, Stdio};
+
+use common::{bench_state, report, sample};
+use mrsh::{sys, ArithmExpr, Program, State};
+
+const LOOP_SCRIPT: &str = r#"
+classify() {
+	case $1 in
+	*[!0-9]*) kind=word ;;
+	*0) kind=round ;;
+	*) kind=number ;;
+	esac
+	name=${2:-item}_$kind
+}
+i=0
+while case $i in 1000) false ;; *) true ;; esac; do
+	classify "$i" n
+	total=$((total + i % 7))
+	i=$((i + 1))
+done
+"#;
+
+const FORK_SCRIPT: &str = r#"
+i=0
+while case $i in 100) false ;; *) true ;; esac; do
+	/bin/true
+	dir=$(pwd)
+	i=$((i + 1))
+done
+"#;
+
+fn corpus() -> Vec<(String, Vec<u8>)> {
+    let dir = std::env::var_os("MRSH_BENCH_CORPUS")
+        .map(PathBuf::from)
+        .unwrap_or_else(|| PathBuf::from(concat!(env!("CARGO_MANIFEST_DIR"), "/benches/corpus")));
+    let mut scripts = fs::read_dir(&dir)
+        .unwrap_or_else(|err| panic!("{}: {}", dir.display(), err))
+        .map(|entry| {
+            let path = entry.unwrap().path();
+            let name = path.file_name().unwrap().to_string_lossy().into_owned();
+            (name, fs::read(&path).unwrap())
+        })
+        .collect::<Vec<_>>();
+    scripts.sort();
+    scripts
+}
+
+fn bench_parse() {
+    let corpus = corpus();
+    for (name, src) in &corpus {
+        let s = sample(|| {
+            Program::parse(src).unwrap();
+        });
+        report(&format!("parse {}", name), &s, Some(src.len()));
+    }
+
+    let bytes = corpus.iter().map(|(_, src)| src.len()).sum();
+    let s = sample(|| {
+        for (_, src) in &corpus {
+            Program::parse(src).unwrap();
+        }
+    });
+    report("parse corpus", &s, Some(bytes));
+}
+
+/// The first argument of the first simple command of `prog`.
+fn first_argument(prog: &Program) -> *const sys::mrsh_word {
+    unsafe {
+        let l = prog.body()[0];
+        let pl = sys::mrsh_and_or_list_get_pipeline((*l).and_or_list);
+        let cmd = *((*pl).commands.data as *const *const sys::mrsh_command);
+        let sc = sys::mrsh_command_get_simple_command(cmd);
+        *((*sc).arguments.data as *const *const sys::mrsh_word)
+    }
+}
+
+fn bench_expand(state: &mut State) {
+    state.env_set("HOME", "/home/bench", sys::MRSH_VAR_ATTRIB_EXPORT);
+    state.env_set(
+        "PATH",
+        "/usr/local/bin:/usr/bin:/bin",
+        sys::MRSH_VAR_ATTRIB_EXPORT,
+    );
+    state.env_set("i", "42", sys::MRSH_VAR_ATTRIB_NONE);
+
+    let words = [
+        ("expand literal", ": /usr/share/doc/mrsh"),
+        ("expand parameter", ": \"$HOME\""),
+        ("expand mixed", ": \"${HOME:-/root}/x-$i-${PATH%%:*}\""),
+        ("expand arithmetic", ": $((i * 2 + 1))"),
+    ];
+    for &(name, src) in &words {
+        let prog = Program::parse(src.as_bytes()).unwrap();
+        let word = first_argument(&prog);
+        let s = sample(|| unsafe {
+            let mut copy = sys::mrsh_word_copy(word);
+            assert_eq!(sys::mrsh_run_word(state.as_ptr(), &mut copy), 0);
+            sys::mrsh_word_destroy(copy);
+        });
+        report(name, &s, None);
+    }
+}
+
+fn bench_arithm(state: &mut State) {
+    state.env_set("a", "17", sys::MRSH_VAR_ATTRIB_NONE);
+    state.env_set("b", "-3", sys::MRSH_VAR_ATTRIB_NONE);
+    state.env_set("c", "5", sys::MRSH_VAR_ATTRIB_NONE);
+    for &src in &[
+        "1 + 2 * 3",
+        "(a * 3 + b) % 7 - (c << 2)",
+        "a > b ? a && c : b || c",
+    ] {
+        let expr = ArithmExpr::parse(src.as_bytes()).unwrap();
+        let s = sample(|| {
+            let mut result = 0;
+            assert!(unsafe {
+                sys::mrsh_run_arithm_expr(state.as_ptr(), expr.as_ptr(), &mut result)
+            });
+        });
+        report(&format!("arithm {}", src), &s, None);
+    }
+}
+
+fn dash() -> Option<String> {
+    let dash = std::env::var("MRSH_BENCH_DASH").unwrap_or_else(|_| "dash".to_owned());
+    let ok = Command::new(&dash)
+        .args(["-c", ":"])
+        .status()
+        .is_ok_and(|status| status.success());
+    if ok {
+        Some(dash)
+    } else {
+        None
+    }
+}
+
+fn run_dash(dash: &str, script: &str) {
+    let status = Command::new(dash)
+        .args(["-c", script])
+        .stdout(Stdio::null())
+        .status()
+        .unwrap();
+    assert!(status.success());
+}
+
+fn bench_run(state: &mut State) {
+    let dash = dash();
+    if let Some(dash) = &dash {
+        let s = sample(|| run_dash(dash, ":"));
+        report("dash startup", &s, None);
+    }
+
+    for &(name, script) in &[("loop-heavy", LOOP_SCRIPT), ("fork-heavy", FORK_SCRIPT)] {
+        let prog = Program::parse(script.as_bytes()).unwrap();
+        let s = sample(|| {
+            assert_eq!(state.run_program(&prog), 0);
+        });
+        report(&format!("run {}", name), &s, None);
+
+        if let Some(dash) = &dash {
+            let s = sample(|| run_dash(dash, script));
+            report(&format!("dash {} (incl. startup)", name), &s, None);
+        }
+    }
+}
+
+fn main() {
+    let mut state = bench_state();
+    bench_parse();
+    bench_expand(&mut state);
+    bench_arithm(&mut state);
+    bench_run(&mut state);
+}
@@ -0,0 +1,59 @@
+//! Loop-heavy scripts dominated by variable references, with 0, 1000 and
+//! 10000 unrelated variables in the table. Each `$name` and each arithmetic
+//! variable is looked up by name on every iteration, and the variable table
+//! has a fixed number of buckets, so lookups slow down as it fills.
+
+mod common;
+
+use common::{bench_loop, bench_state};
+use mrsh::sys;
+
+const ITERS: u32 = 20_000;
+
+const SCRIPTS: &[(&str, &str)] = &[
+    (
+        "parameters",
+        r#"x=$host:$port/$path?$query; y=${x%%/*}; z=${path:-/}"#,
+    ),
+    ("arithmetic", "sum=$((sum + a * b - c % 7 + i))"),
+    ("mixed", r#"key=${prefix}_$i; total=$((total + ${#key}))"#),
+];
+
+fn main() {
+    let mut state = bench_state();
+    for &(name, value) in &[
+        ("host", "example.org"),
+        ("port", "8080"),
+        ("path", "/api/v1/items"),
+        ("query", "limit=10"),
+        ("prefix", "item"),
+        ("a", "3"),
+        ("b", "7"),
+        ("c", "11"),
+        ("sum", "0"),
+        ("total", "0"),
+    ] {
+        state.env_set(name, value, sys::MRSH_VAR_ATTRIB_NONE);
+    }
+
+    let mut filler = 0;
+    for &vars in &[0, 1000, 10_000] {
+        while filler < vars {
+            state.env_set(
+                &format!("filler_{}", filler),
+                "x",
+                sys::MRSH_VAR_ATTRIB_NONE,
+            );
+            filler += 1;
+        }
+        for &(name, body) in SCRIPTS {
+            bench_loop(
+                &mut state,
+                &format!("{} vars, {}", vars, name),
+                "",
+                ITERS,
+                body,
+            );
+        }
+    }
+}
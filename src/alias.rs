@@ -0,0 +1,223 @@
+//! Alias tables for parsers.
+//!
+//! The parser asks its alias callback about every word in command position.
+//! An `AliasTable` can be shared by any number of parsers, and each parser
+//! keeps its own cache of resolved names in front of it, so repeated lookups
+//! don't take the table's lock. Every change to the table bumps its
+//! generation, which drops the caches the next time they are used.
+
+use std::collections::HashMap;
+use std::ffi::{CStr, CString};
+use std::os::raw::{c_char, c_void};
+use std::ptr;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Arc, RwLock};
+
+use crate::parser::Parser;
+use crate::sys;
+
+/// A set of aliases, shared between parsers.
+#[derive(Default)]
+pub struct AliasTable {
+    aliases: RwLock<HashMap<CString, CString>>,
+    generation: AtomicU64,
+}
+
+impl AliasTable {
+    pub fn new() -> AliasTable {
+        AliasTable::default()
+    }
+
+    /// Define or redefine an alias.
+    pub fn set(&self, name: &str, value: &str) {
+        self.extend(Some((name, value)));
+    }
+
+    /// Define many aliases at once, e.g. from an rc file. Parsers only have
+    /// to drop their caches once.
+    pub fn extend<'a, I: IntoIterator<Item = (&'a str, &'a str)>>(&self, aliases: I) {
+        let mut table = self.aliases.write().unwrap();
+        for (name, value) in aliases {
+            table.insert(
+                CString::new(name).expect("alias name contains a NUL byte"),
+                CString::new(value).expect("alias value contains a NUL byte"),
+            );
+        }
+        self.generation.fetch_add(1, Ordering::Release);
+    }
+
+    /// Remove an alias. Returns false if it wasn't defined.
+    pub fn unset(&self, name: &str) -> bool {
+        let name = CString::new(name).expect("alias name contains a NUL byte");
+        let removed = self.aliases.write().unwrap().remove(&name).is_some();
+        if removed {
+            self.generation.fetch_add(1, Ordering::Release);
+        }
+        removed
+    }
+
+    /// Remove all aliases.
+    pub fn clear(&self) {
+        self.aliases.write().unwrap().clear();
+        self.generation.fetch_add(1, Ordering::Release);
+    }
+
+    pub fn get(&self, name: &str) -> Option<String> {
+        let name = CString::new(name).ok()?;
+        let table = self.aliases.read().unwrap();
+        Some(table.get(&name)?.to_string_lossy().into_owned())
+    }
+
+    pub fn len(&self) -> usize {
+        self.aliases.read().unwrap().len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Incremented on every change to the table.
+    pub fn generation(&self) -> u64 {
+        self.generation.load(Ordering::Acquire)
+    }
+}
+
+/// The most misses a parser caches per table generation. A long-lived
+/// parser, e.g. an interactive shell's, sees an unbounded number of
+/// distinct command words; past this many, misses are looked up in the
+/// table every time.
+const MAX_MISSES: usize = 4096;
+
+/// A parser's view of an `AliasTable`. Misses are cached too, since most
+/// command words aren't aliases.
+pub(crate) struct AliasCache {
+    table: Arc<AliasTable>,
+    generation: u64,
+    resolved: HashMap<Box<[u8]>, Option<CString>>,
+    misses: usize,
+}
+
+impl AliasCache {
+    fn lookup(&mut self, name: &CStr) -> *const c_char {
+        let generation = self.table.generation();
+        if generation != self.generation {
+            self.resolved.clear();
+            self.misses = 0;
+            self.generation = generation;
+        }
+        if let Some(value) = self.resolved.get(name.to_bytes()) {
+            return as_ptr(value);
+        }
+        let value = self.table.aliases.read().unwrap().get(name).cloned();
+        if value.is_none() {
+            if self.misses == MAX_MISSES {
+                return ptr::null();
+            }
+            self.misses += 1;
+        }
+        // The string's buffer doesn't move with it
+        let ptr = as_ptr(&value);
+        self.resolved.insert(name.to_bytes().into(), value);
+        ptr
+    }
+}
+
+fn as_ptr(value: &Option<CString>) -> *const c_char {
+    value.as_ref().map_or(ptr::null(), |value| value.as_ptr())
+}
+
+unsafe extern "C" fn alias_func(name: *const c_char, user_data: *mut c_void) -> *const c_char {
+    let cache = &mut *(user_data as *mut AliasCache);
+    cache.lookup(CStr::from_ptr(name))
+}
+
+impl Parser {
+    /// Resolve aliases from `table` instead of the callback installed by
+    /// `mrsh_state_set_parser_alias_func`. A value handed to the parser stays
+    /// valid until its first lookup after the table has changed.
+    pub fn set_aliases(&mut self, table: Arc<AliasTable>) {
+        let mut cache = Box::new(AliasCache {
+            generation: table.generation(),
+            table,
+            resolved: HashMap::new(),
+            misses: 0,
+        });
+        let user_data = &mut *cache as *mut AliasCache as *mut c_void;
+        unsafe { sys::mrsh_parser_set_alias_func(self.as_ptr(), Some(alias_func), user_data) };
+        self.aliases = Some(cache);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::parser::{array_slice, Program};
+
+    /// The words of the one simple command in `prog`.
+    fn words(prog: &Program) -> Vec<String> {
+        unsafe {
+            let l = prog.body()[0];
+            let pl = &*sys::mrsh_and_or_list_get_pipeline((*l).and_or_list);
+            let cmd = array_slice::<sys::mrsh_command>(&pl.commands)[0];
+            let sc = &*sys::mrsh_command_get_simple_command(cmd);
+            Some(sc.name)
+                .into_iter()
+                .chain(array_slice::<sys::mrsh_word>(&sc.arguments).iter().copied())
+                .map(|word| {
+                    let s = sys::mrsh_word_str(word);
+                    let owned = CStr::from_ptr(s).to_string_lossy().into_owned();
+                    libc::free(s.cast());
+                    owned
+                })
+                .collect()
+        }
+    }
+
+    #[test]
+    fn changes_after_cached_lookups() {
+        let table = Arc::new(AliasTable::new());
+        let mut parser = Parser::from_bytes(b"ll x\nll x\nll x\nll x\n");
+        parser.set_aliases(table.clone());
+
+        // Cached miss, then defined
+        assert_eq!(words(&parser.parse_line().unwrap()), ["ll", "x"]);
+        table.set("ll", "ls -l");
+        assert_eq!(words(&parser.parse_line().unwrap()), ["ls", "-l", "x"]);
+
+        // Cached hit, then redefined and removed
+        table.set("ll", "ls -la");
+        assert_eq!(words(&parser.parse_line().unwrap()), ["ls", "-la", "x"]);
+        assert!(table.unset("ll"));
+        assert_eq!(words(&parser.parse_line().unwrap()), ["ll", "x"]);
+    }
+
+    #[test]
+    fn bounded_misses() {
+        let table = Arc::new(AliasTable::new());
+        table.set("ll", "ls -l");
+        let mut cache = AliasCache {
+            generation: table.generation(),
+            table: table.clone(),
+            resolved: HashMap::new(),
+            misses: 0,
+        };
+        for i in 0..MAX_MISSES * 2 {
+            let name = CString::new(format!("cmd_{}", i)).unwrap();
+            assert!(cache.lookup(&name).is_null());
+        }
+        assert_eq!(cache.resolved.len(), MAX_MISSES);
+
+        // Hits are still cached, and misses still resolve correctly
+        let ll = CString::new("ll").unwrap();
+        let value = unsafe { CStr::from_ptr(cache.lookup(&ll)) };
+        assert_eq!(value.to_str().unwrap(), "ls -l");
+        assert_eq!(cache.resolved.len(), MAX_MISSES + 1);
+        let extra = CString::new(format!("cmd_{}", MAX_MISSES * 2)).unwrap();
+        assert!(cache.lookup(&extra).is_null());
+
+        // A new generation starts over
+        table.set("la", "ls -a");
+        assert!(cache.lookup(&extra).is_null());
+        assert_eq!(cache.resolved.len(), 1);
+    }
+}
@@ -0,0 +1,698 @@
+//! Compiled arithmetic expressions.
+//!
+//! An `mrsh_arithm_expr` tree is lowered once into flat bytecode for a small
+//! stack machine. Literal subtrees are folded at compile time, `&&`, `||` and
+//! `?:` become jumps, and variable names are interned into slots so that
+//! evaluation does no allocation besides the value stack.
+
+use std::collections::HashMap;
+use std::ffi::{CStr, CString};
+use std::fmt;
+use std::io::Write;
+use std::marker::PhantomData;
+use std::os::raw::{c_char, c_long};
+use std::ptr::NonNull;
+
+use crate::parser::{array_slice, ParseError, Parser, Program};
+use crate::state::State;
+use crate::sys;
+
+/// An owned arithmetic expression tree. Wraps `struct mrsh_arithm_expr`.
+pub struct ArithmExpr {
+    raw: NonNull<sys::mrsh_arithm_expr>,
+}
+
+impl ArithmExpr {
+    /// Parse the body of an arithmetic expansion, e.g. `i + 1`.
+    pub fn parse(src: &[u8]) -> Result<ArithmExpr, ParseError> {
+        Parser::from_bytes(src).parse_arithm_expr()
+    }
+
+    /// Take ownership of an expression allocated by libmrsh.
+    ///
+    /// # Safety
+    ///
+    /// `raw` must be a valid, uniquely owned expression that can be released
+    /// with `mrsh_arithm_expr_destroy`.
+    pub unsafe fn from_raw(raw: *mut sys::mrsh_arithm_expr) -> ArithmExpr {
+        ArithmExpr {
+            raw: NonNull::new(raw).expect("null mrsh_arithm_expr"),
+        }
+    }
+
+    pub fn as_ptr(&self) -> *mut sys::mrsh_arithm_expr {
+        self.raw.as_ptr()
+    }
+}
+
+impl Drop for ArithmExpr {
+    fn drop(&mut self) {
+        unsafe { sys::mrsh_arithm_expr_destroy(self.as_ptr()) }
+    }
+}
+
+impl Parser {
+    /// Parse an arithmetic expression.
+    pub fn parse_arithm_expr(&mut self) -> Result<ArithmExpr, ParseError> {
+        let expr = unsafe { sys::mrsh_parse_arithm_expr(self.as_ptr()) };
+        if let Some(err) = self.error() {
+            if !expr.is_null() {
+                unsafe { sys::mrsh_arithm_expr_destroy(expr) };
+            }
+            return Err(err);
+        }
+        match NonNull::new(expr) {
+            Some(raw) => Ok(ArithmExpr { raw }),
+            None => Err(ParseError {
+                message: "expected an arithmetic expression".to_owned(),
+                position: sys::mrsh_position {
+                    offset: 0,
+                    line: 1,
+                    column: 1,
+                },
+            }),
+        }
+    }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum Op {
+    Const(c_long),
+    /// Push the value of a variable.
+    Load(usize),
+    /// Assign the top of the stack to a variable, leaving it in place.
+    Store(usize),
+    /// Replace the top of the stack with the variable combined with it by a
+    /// binary operator, and assign the result to the variable. The variable
+    /// is read after the value is computed, as in the shell.
+    Update(usize, sys::mrsh_arithm_binop_type),
+    Unop(sys::mrsh_arithm_unop_type),
+    /// Any binary operator except `&&` and `||`.
+    Binop(sys::mrsh_arithm_binop_type),
+    /// Replace the top of the stack with 1 if it is non-zero, 0 otherwise.
+    Truth,
+    Jump(usize),
+    /// Pop the top of the stack and jump if it is zero.
+    JumpIfZero(usize),
+    /// Pop the top of the stack and jump if it is non-zero.
+    JumpIfNonZero(usize),
+}
+
+/// A compiled arithmetic expression.
+#[derive(Debug, Clone)]
+pub struct CompiledArithm {
+    code: Vec<Op>,
+    names: Vec<CString>,
+    max_depth: usize,
+}
+
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub enum ArithmError {
+    DivisionByZero,
+    /// An unset variable was read with `set -u`.
+    Unbound(String),
+    /// A variable's value is not a decimal integer.
+    NotANumber(String, String),
+    ReadOnly(String),
+}
+
+impl fmt::Display for ArithmError {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self {
+            ArithmError::DivisionByZero => f.write_str("division by zero"),
+            ArithmError::Unbound(name) => write!(f, "{}: unbound variable", name),
+            ArithmError::NotANumber(name, value) => {
+                write!(f, "{}: not a number: {}", name, value)
+            }
+            ArithmError::ReadOnly(name) => write!(f, "{}: cannot modify readonly variable", name),
+        }
+    }
+}
+
+impl std::error::Error for ArithmError {}
+
+impl CompiledArithm {
+    /// Parse and compile the body of an arithmetic expansion.
+    pub fn parse(src: &[u8]) -> Result<CompiledArithm, ParseError> {
+        Ok(CompiledArithm::compile(&ArithmExpr::parse(src)?))
+    }
+
+    pub fn compile(expr: &ArithmExpr) -> CompiledArithm {
+        let mut c = Compiler {
+            code: Vec::new(),
+            slots: HashMap::new(),
+            names: Vec::new(),
+            depth: 0,
+            max_depth: 0,
+        };
+        unsafe { c.expr(expr.as_ptr()) };
+        CompiledArithm {
+            code: c.code,
+            names: c.names,
+            max_depth: c.max_depth,
+        }
+    }
+
+    /// The value of the expression, if it doesn't depend on any variable.
+    pub fn constant(&self) -> Option<c_long> {
+        match self.code[..] {
+            [Op::Const(v)] => Some(v),
+            _ => None,
+        }
+    }
+
+    /// Evaluate the expression, reading and assigning variables in `state`.
+    pub fn eval(&self, state: &mut State) -> Result<c_long, ArithmError> {
+        let mut stack = Vec::with_capacity(self.max_depth);
+        let mut pc = 0;
+        while let Some(&op) = self.code.get(pc) {
+            pc += 1;
+            match op {
+                Op::Const(v) => stack.push(v),
+                Op::Load(slot) => stack.push(self.load(state, slot)?),
+                Op::Store(slot) => self.store(state, slot, *stack.last().unwrap())?,
+                Op::Update(slot, type_) => {
+                    let value = stack.last_mut().unwrap();
+                    let v = binop(type_, self.load(state, slot)?, *value)
+                        .ok_or(ArithmError::DivisionByZero)?;
+                    self.store(state, slot, v)?;
+                    *value = v;
+                }
+                Op::Unop(type_) => {
+                    let v = stack.last_mut().unwrap();
+                    *v = unop(type_, *v);
+                }
+                Op::Binop(type_) => {
+                    let right = stack.pop().unwrap();
+                    let left = stack.last_mut().unwrap();
+                    *left = binop(type_, *left, right).ok_or(ArithmError::DivisionByZero)?;
+                }
+                Op::Truth => {
+                    let v = stack.last_mut().unwrap();
+                    *v = (*v != 0) as c_long;
+                }
+                Op::Jump(target) => pc = target,
+                Op::JumpIfZero(target) => {
+                    if stack.pop().unwrap() == 0 {
+                        pc = target;
+                    }
+                }
+                Op::JumpIfNonZero(target) => {
+                    if stack.pop().unwrap() != 0 {
+                        pc = target;
+                    }
+                }
+            }
+        }
+        Ok(stack.pop().unwrap())
+    }
+
+    fn name(&self, slot: usize) -> String {
+        self.names[slot].to_string_lossy().into_owned()
+    }
+
+    fn load(&self, state: &State, slot: usize) -> Result<c_long, ArithmError> {
+        let value = unsafe {
+            sys::mrsh_env_get(
+                state.as_ptr(),
+                self.names[slot].as_ptr(),
+                std::ptr::null_mut(),
+            )
+        };
+        if value.is_null() {
+            let options = unsafe { (*state.as_ptr()).options };
+            if options & sys::MRSH_OPT_NOUNSET != 0 {
+                return Err(ArithmError::Unbound(self.name(slot)));
+            }
+            return Ok(0);
+        }
+        let mut end: *mut c_char = std::ptr::null_mut();
+        let v = unsafe { libc::strtol(value, &mut end, 10) };
+        if std::ptr::eq(end, value) || unsafe { *end } != 0 {
+            let value = unsafe { CStr::from_ptr(value) }
+                .to_string_lossy()
+                .into_owned();
+            return Err(ArithmError::NotANumber(self.name(slot), value));
+        }
+        Ok(v)
+    }
+
+    fn store(&self, state: &mut State, slot: usize, v: c_long) -> Result<(), ArithmError> {
+        let name = self.names[slot].as_ptr();
+        let mut attribs = 0;
+        unsafe { sys::mrsh_env_get(state.as_ptr(), name, &mut attribs) };
+        if attribs & sys::MRSH_VAR_ATTRIB_READONLY != 0 {
+            return Err(ArithmError::ReadOnly(self.name(slot)));
+        }
+        // Large enough for "-9223372036854775808" and the NUL terminator
+        let mut buf = [0u8; 24];
+        write!(&mut buf[..], "{}", v).unwrap();
+        unsafe { sys::mrsh_env_set(state.as_ptr(), name, buf.as_ptr().cast(), attribs) };
+        Ok(())
+    }
+}
+
+fn unop(type_: sys::mrsh_arithm_unop_type, v: c_long) -> c_long {
+    match type_ {
+        sys::MRSH_ARITHM_UNOP_PLUS => v,
+        sys::MRSH_ARITHM_UNOP_MINUS => v.wrapping_neg(),
+        sys::MRSH_ARITHM_UNOP_TILDE => !v,
+        sys::MRSH_ARITHM_UNOP_BANG => (v == 0) as c_long,
+        _ => unreachable!(),
+    }
+}
+
+/// Apply a binary operator. Returns None on division by zero.
+fn binop(type_: sys::mrsh_arithm_binop_type, left: c_long, right: c_long) -> Option<c_long> {
+    Some(match type_ {
+        sys::MRSH_ARITHM_BINOP_ASTERISK => left.wrapping_mul(right),
+        sys::MRSH_ARITHM_BINOP_SLASH => {
+            if right == 0 {
+                return None;
+            }
+            left.wrapping_div(right)
+        }
+        sys::MRSH_ARITHM_BINOP_PERCENT => {
+            if right == 0 {
+                return None;
+            }
+            left.wrapping_rem(right)
+        }
+        sys::MRSH_ARITHM_BINOP_PLUS => left.wrapping_add(right),
+        sys::MRSH_ARITHM_BINOP_MINUS => left.wrapping_sub(right),
+        sys::MRSH_ARITHM_BINOP_DLESS => left.wrapping_shl(right as u32),
+        sys::MRSH_ARITHM_BINOP_DGREAT => left.wrapping_shr(right as u32),
+        sys::MRSH_ARITHM_BINOP_LESS => (left < right) as c_long,
+        sys::MRSH_ARITHM_BINOP_LESSEQ => (left <= right) as c_long,
+        sys::MRSH_ARITHM_BINOP_GREAT => (left > right) as c_long,
+        sys::MRSH_ARITHM_BINOP_GREATEQ => (left >= right) as c_long,
+        sys::MRSH_ARITHM_BINOP_DEQ => (left == right) as c_long,
+        sys::MRSH_ARITHM_BINOP_BANGEQ => (left != right) as c_long,
+        sys::MRSH_ARITHM_BINOP_AND => left & right,
+        sys::MRSH_ARITHM_BINOP_CIRC => left ^ right,
+        sys::MRSH_ARITHM_BINOP_OR => left | right,
+        _ => unreachable!(),
+    })
+}
+
+/// The binary operator applied by a compound assignment.
+fn assign_binop(op: sys::mrsh_arithm_assign_op) -> sys::mrsh_arithm_binop_type {
+    match op {
+        sys::MRSH_ARITHM_ASSIGN_ASTERISK => sys::MRSH_ARITHM_BINOP_ASTERISK,
+        sys::MRSH_ARITHM_ASSIGN_SLASH => sys::MRSH_ARITHM_BINOP_SLASH,
+        sys::MRSH_ARITHM_ASSIGN_PERCENT => sys::MRSH_ARITHM_BINOP_PERCENT,
+        sys::MRSH_ARITHM_ASSIGN_PLUS => sys::MRSH_ARITHM_BINOP_PLUS,
+        sys::MRSH_ARITHM_ASSIGN_MINUS => sys::MRSH_ARITHM_BINOP_MINUS,
+        sys::MRSH_ARITHM_ASSIGN_DLESS => sys::MRSH_ARITHM_BINOP_DLESS,
+        sys::MRSH_ARITHM_ASSIGN_DGREAT => sys::MRSH_ARITHM_BINOP_DGREAT,
+        sys::MRSH_ARITHM_ASSIGN_AND => sys::MRSH_ARITHM_BINOP_AND,
+        sys::MRSH_ARITHM_ASSIGN_CIRC => sys::MRSH_ARITHM_BINOP_CIRC,
+        sys::MRSH_ARITHM_ASSIGN_OR => sys::MRSH_ARITHM_BINOP_OR,
+        _ => unreachable!(),
+    }
+}
+
+struct Compiler {
+    code: Vec<Op>,
+    slots: HashMap<CString, usize>,
+    names: Vec<CString>,
+    depth: usize,
+    max_depth: usize,
+}
+
+impl Compiler {
+    fn emit(&mut self, op: Op) {
+        match op {
+            Op::Const(_) | Op::Load(_) => {
+                self.depth += 1;
+                self.max_depth = self.max_depth.max(self.depth);
+            }
+            Op::Binop(_) | Op::JumpIfZero(_) | Op::JumpIfNonZero(_) => self.depth -= 1,
+            _ => {}
+        }
+        self.code.push(op);
+    }
+
+    /// Emit a jump whose target is patched later.
+    fn emit_jump(&mut self, op: fn(usize) -> Op) -> usize {
+        self.emit(op(0));
+        self.code.len() - 1
+    }
+
+    fn patch(&mut self, at: usize) {
+        let target = self.code.len();
+        self.code[at] = match self.code[at] {
+            Op::Jump(_) => Op::Jump(target),
+            Op::JumpIfZero(_) => Op::JumpIfZero(target),
+            Op::JumpIfNonZero(_) => Op::JumpIfNonZero(target),
+            _ => unreachable!(),
+        };
+    }
+
+    /// If everything emitted since `start` is a single constant, remove it
+    /// and return its value.
+    fn take_const(&mut self, start: usize) -> Option<c_long> {
+        match self.code[start..] {
+            [Op::Const(v)] => {
+                self.code.truncate(start);
+                self.depth -= 1;
+                Some(v)
+            }
+            _ => None,
+        }
+    }
+
+    /// Like `take_const` for two consecutive constants.
+    fn take_const_pair(&mut self, start: usize) -> Option<(c_long, c_long)> {
+        match self.code[start..] {
+            [Op::Const(a), Op::Const(b)] => {
+                self.code.truncate(start);
+                self.depth -= 2;
+                Some((a, b))
+            }
+            _ => None,
+        }
+    }
+
+    fn slot(&mut self, name: *const c_char) -> usize {
+        let name = unsafe { CStr::from_ptr(name) };
+        if let Some(&slot) = self.slots.get(name) {
+            return slot;
+        }
+        let slot = self.names.len();
+        self.names.push(name.to_owned());
+        self.slots.insert(name.to_owned(), slot);
+        slot
+    }
+
+    unsafe fn expr(&mut self, expr: *const sys::mrsh_arithm_expr) {
+        let start = self.code.len();
+        match (*expr).type_ {
+            sys::MRSH_ARITHM_LITERAL => {
+                let lit = &*sys::mrsh_arithm_expr_get_literal(expr);
+                self.emit(Op::Const(lit.value));
+            }
+            sys::MRSH_ARITHM_VARIABLE => {
+                let var = &*sys::mrsh_arithm_expr_get_variable(expr);
+                let slot = self.slot(var.name);
+                self.emit(Op::Load(slot));
+            }
+            sys::MRSH_ARITHM_UNOP => {
+                let u = &*sys::mrsh_arithm_expr_get_unop(expr);
+                self.expr(u.body);
+                match self.take_const(start) {
+                    Some(v) => self.emit(Op::Const(unop(u.type_, v))),
+                    None => self.emit(Op::Unop(u.type_)),
+                }
+            }
+            sys::MRSH_ARITHM_BINOP => {
+                let b = &*sys::mrsh_arithm_expr_get_binop(expr);
+                match b.type_ {
+                    sys::MRSH_ARITHM_BINOP_DAND => self.logical(b, false),
+                    sys::MRSH_ARITHM_BINOP_DOR => self.logical(b, true),
+                    _ => {
+                        self.expr(b.left);
+                        self.expr(b.right);
+                        // Division by zero is left for evaluation to report
+                        let folded = self
+                            .take_const_pair(start)
+                            .map(|(l, r)| (l, r, binop(b.type_, l, r)));
+                        match folded {
+                            Some((_, _, Some(v))) => self.emit(Op::Const(v)),
+                            Some((l, r, None)) => {
+                                self.emit(Op::Const(l));
+                                self.emit(Op::Const(r));
+                                self.emit(Op::Binop(b.type_));
+                            }
+                            None => self.emit(Op::Binop(b.type_)),
+                        }
+                    }
+                }
+            }
+            sys::MRSH_ARITHM_COND => {
+                let c = &*sys::mrsh_arithm_expr_get_cond(expr);
+                self.expr(c.condition);
+                if let Some(v) = self.take_const(start) {
+                    self.expr(if v != 0 { c.body } else { c.else_part });
+                    return;
+                }
+                let else_jump = self.emit_jump(Op::JumpIfZero);
+                self.expr(c.body);
+                let end_jump = self.emit_jump(Op::Jump);
+                // Only one branch runs
+                self.depth -= 1;
+                self.patch(else_jump);
+                self.expr(c.else_part);
+                self.patch(end_jump);
+            }
+            sys::MRSH_ARITHM_ASSIGN => {
+                let a = &*sys::mrsh_arithm_expr_get_assign(expr);
+                let slot = self.slot(a.name);
+                self.expr(a.value);
+                if a.op == sys::MRSH_ARITHM_ASSIGN_NONE {
+                    self.emit(Op::Store(slot));
+                } else {
+                    self.emit(Op::Update(slot, assign_binop(a.op)));
+                }
+            }
+            _ => unreachable!(),
+        }
+    }
+
+    /// Compile `&&` (`or == false`) or `||` (`or == true`) with
+    /// short-circuiting.
+    unsafe fn logical(&mut self, b: &sys::mrsh_arithm_binop, or: bool) {
+        let start = self.code.len();
+        self.expr(b.left);
+        if let Some(v) = self.take_const(start) {
+            if (v != 0) == or {
+                self.emit(Op::Const(or as c_long));
+            } else {
+                self.expr(b.right);
+                match self.take_const(start) {
+                    Some(v) => self.emit(Op::Const((v != 0) as c_long)),
+                    None => self.emit(Op::Truth),
+                }
+            }
+            return;
+        }
+        let short_jump = self.emit_jump(if or {
+            Op::JumpIfNonZero
+        } else {
+            Op::JumpIfZero
+        });
+        self.expr(b.right);
+        self.emit(Op::Truth);
+        let end_jump = self.emit_jump(Op::Jump);
+        self.depth -= 1;
+        self.patch(short_jump);
+        self.emit(Op::Const(or as c_long));
+        self.patch(end_jump);
+    }
+}
+
+/// Compiled forms of the `$((...))` words of one program, built on first use.
+///
+/// Entries are keyed on the address of the `mrsh_word_arithmetic` node, so the
+/// cache borrows the program it was created for.
+pub struct ArithmCache<'p> {
+    compiled: HashMap<*const sys::mrsh_word_arithmetic, Option<CompiledArithm>>,
+    _prog: PhantomData<&'p Program>,
+}
+
+impl<'p> ArithmCache<'p> {
+    pub fn new(_prog: &'p Program) -> ArithmCache<'p> {
+        ArithmCache {
+            compiled: HashMap::new(),
+            _prog: PhantomData,
+        }
+    }
+
+    /// Get the compiled form of an arithmetic word of the program. Returns
+    /// None if the word has to be expanded before it can be parsed (e.g.
+    /// `$(($x + $(f)))`) or doesn't parse; these go through
+    /// `mrsh_run_word` as usual.
+    pub fn get(&mut self, word: &'p sys::mrsh_word_arithmetic) -> Option<&CompiledArithm> {
+        self.compiled
+            .entry(word as *const _)
+            .or_insert_with(|| {
+                let src = unsafe { static_text(word.body)? };
+                CompiledArithm::parse(&src).ok()
+            })
+            .as_ref()
+    }
+}
+
+/// The text of a word made only of string parts, which expands to itself.
+unsafe fn static_text(word: *const sys::mrsh_word) -> Option<Vec<u8>> {
+    match (*word).type_ {
+        sys::MRSH_WORD_STRING => {
+            let ws = &*sys::mrsh_word_get_string(word);
+            Some(CStr::from_ptr(ws.str).to_bytes().to_vec())
+        }
+        sys::MRSH_WORD_LIST => {
+            let wl = &*sys::mrsh_word_get_list(word);
+            let mut text = Vec::new();
+            for &child in array_slice::<sys::mrsh_word>(&wl.children) {
+                text.extend(static_text(child)?);
+            }
+            Some(text)
+        }
+        _ => None,
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const VARS: &[(&str, &str)] = &[("a", "6"), ("b", "-4"), ("z", "0")];
+
+    fn state() -> State {
+        let mut state = State::new();
+        for &(name, value) in VARS {
+            state.env_set(name, value, sys::MRSH_VAR_ATTRIB_NONE);
+        }
+        state
+    }
+
+    /// Evaluate `src` with the shell and with the compiled form, each in a
+    /// fresh state, and check that they agree on the result, on whether it
+    /// failed and on the variables left behind.
+    fn eval_both(src: &str) -> Result<c_long, ArithmError> {
+        let expr = ArithmExpr::parse(src.as_bytes()).unwrap();
+        let shell = state();
+        let mut result = 0;
+        let ok = unsafe { sys::mrsh_run_arithm_expr(shell.as_ptr(), expr.as_ptr(), &mut result) };
+
+        let mut compiled = state();
+        let value = CompiledArithm::compile(&expr).eval(&mut compiled);
+        match &value {
+            Ok(v) => assert!(
+                ok && *v == result,
+                "{}: shell {}, compiled {}",
+                src,
+                result,
+                v
+            ),
+            Err(err) => assert!(!ok, "{}: shell {}, compiled {}", src, result, err),
+        }
+        for name in &["a", "b", "x", "y", "z"] {
+            assert_eq!(
+                shell.env_get(name),
+                compiled.env_get(name),
+                "{}: ${}",
+                src,
+                name
+            );
+        }
+        value
+    }
+
+    fn check(src: &str) -> c_long {
+        eval_both(src).unwrap()
+    }
+
+    #[test]
+    fn constants() {
+        for src in &[
+            "1 + 2 * 3",
+            "(7 - 10) / 2 % 5",
+            "~5 ^ 3 | 8 & 12",
+            "-(1 << 4) >> 2",
+        ] {
+            let compiled = CompiledArithm::parse(src.as_bytes()).unwrap();
+            assert_eq!(compiled.constant(), Some(check(src)), "{}", src);
+        }
+    }
+
+    #[test]
+    fn short_circuit() {
+        check("z && (x = 1)");
+        check("a && (x = 1)");
+        check("a || (x = 1)");
+        check("z || (x = 1)");
+        check("a > b ? (x = 1) : (y = 2)");
+        check("a < b ? (x = 1) : (y = 2)");
+        check("0 && (x = 1)");
+        check("1 || (x = 1)");
+        check("0 ? (x = 1) : 2");
+        check("(x = a) && (y = b) || (z = 3)");
+    }
+
+    #[test]
+    fn division_by_zero() {
+        assert_eq!(eval_both("a / z"), Err(ArithmError::DivisionByZero));
+        assert_eq!(eval_both("a % z"), Err(ArithmError::DivisionByZero));
+        assert_eq!(eval_both("1 / 0"), Err(ArithmError::DivisionByZero));
+        assert_eq!(eval_both("x /= z"), Err(ArithmError::DivisionByZero));
+        // Not evaluated, so not an error
+        check("z && 1 / 0");
+    }
+
+    #[test]
+    fn assignments() {
+        for op in &[
+            "=", "*=", "/=", "%=", "+=", "-=", "<<=", ">>=", "&=", "^=", "|=",
+        ] {
+            check(&format!("a {} 3", op));
+            check(&format!("x {} b", op));
+            check(&format!("y = (a {} 5) + a", op));
+        }
+        check("x = y = a + 1");
+        // The variable is read after the value is computed
+        check("x += (x = 5)");
+        check("a -= (a = 1) + a");
+        check("b <<= (b = 2)");
+    }
+
+    #[test]
+    fn readonly() {
+        for src in &["a = 1", "a += 1"] {
+            let mut state = state();
+            state.env_set("a", "6", sys::MRSH_VAR_ATTRIB_READONLY);
+            let compiled = CompiledArithm::parse(src.as_bytes()).unwrap();
+            assert_eq!(
+                compiled.eval(&mut state),
+                Err(ArithmError::ReadOnly("a".to_owned()))
+            );
+            assert_eq!(state.env_get("a").as_deref(), Some("6"));
+
+            let expr = ArithmExpr::parse(src.as_bytes()).unwrap();
+            let mut result = 0;
+            assert!(!unsafe {
+                sys::mrsh_run_arithm_expr(state.as_ptr(), expr.as_ptr(), &mut result)
+            });
+        }
+    }
+
+    fn attribs(state: &State, name: &str) -> u32 {
+        let name = CString::new(name).unwrap();
+        let mut attribs = 0;
+        unsafe { sys::mrsh_env_get(state.as_ptr(), name.as_ptr(), &mut attribs) };
+        attribs
+    }
+
+    #[test]
+    fn store_keeps_attributes() {
+        for src in &["x = 1", "x += 1"] {
+            let expr = ArithmExpr::parse(src.as_bytes()).unwrap();
+            let mut shell = state();
+            let mut compiled = state();
+            shell.env_set("x", "0", sys::MRSH_VAR_ATTRIB_EXPORT);
+            compiled.env_set("x", "0", sys::MRSH_VAR_ATTRIB_EXPORT);
+            let mut result = 0;
+            assert!(unsafe {
+                sys::mrsh_run_arithm_expr(shell.as_ptr(), expr.as_ptr(), &mut result)
+            });
+            CompiledArithm::compile(&expr).eval(&mut compiled).unwrap();
+            assert_eq!(attribs(&compiled, "x"), attribs(&shell, "x"), "{}", src);
+            assert_eq!(
+                attribs(&compiled, "x"),
+                sys::MRSH_VAR_ATTRIB_EXPORT,
+                "{}",
+                src
+            );
+        }
+    }
+}
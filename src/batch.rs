@@ -0,0 +1,87 @@
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::thread;
+
+use crate::parser::{ParseError, Program};
+
+/// Parse many independent scripts on a pool of `threads` threads, or one per
+/// available CPU if `threads` is 0. Results are in input order.
+///
+/// Each input gets its own parser; libmrsh's parser keeps no global state, so
+/// parsers on different threads don't interfere.
+pub fn parse_batch<S: AsRef<[u8]> + Sync>(
+    inputs: &[S],
+    threads: usize,
+) -> Vec<Result<Program, ParseError>> {
+    let threads = if threads == 0 {
+        thread::available_parallelism().map_or(1, |n| n.get())
+    } else {
+        threads
+    };
+    let threads = threads.min(inputs.len()).max(1);
+
+    // Inputs are handed out one at a time so that a few large scripts don't
+    // leave the other threads idle
+    let next = AtomicUsize::new(0);
+    let mut results = Vec::with_capacity(inputs.len());
+    results.resize_with(inputs.len(), || None);
+    thread::scope(|s| {
+        let workers = (0..threads)
+            .map(|_| {
+                s.spawn(|| {
+                    let mut parsed = Vec::new();
+                    loop {
+                        let i = next.fetch_add(1, Ordering::Relaxed);
+                        if i >= inputs.len() {
+                            return parsed;
+                        }
+                        parsed.push((i, Program::parse(inputs[i].as_ref())));
+                    }
+                })
+            })
+            .collect::<Vec<_>>();
+        for worker in workers {
+            for (i, res) in worker.join().unwrap() {
+                results[i] = Some(res);
+            }
+        }
+    });
+    results.into_iter().map(Option::unwrap).collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::serialize::serialize;
+
+    #[test]
+    fn results_in_input_order() {
+        let inputs = (0..200)
+            .map(|i| "echo x\n".repeat(i % 17 + 1) + &format!("echo {}\n", i))
+            .collect::<Vec<_>>();
+        for &threads in &[0, 1, 4, 500] {
+            let results = parse_batch(&inputs, threads);
+            assert_eq!(results.len(), inputs.len());
+            for (input, res) in inputs.iter().zip(&results) {
+                let expected = Program::parse(input.as_bytes()).unwrap();
+                assert_eq!(serialize(res.as_ref().unwrap()), serialize(&expected));
+            }
+        }
+    }
+
+    #[test]
+    fn error_at_its_index() {
+        let inputs = ["echo a", "echo b", "if true; then", "echo d", ""];
+        let results = parse_batch(&inputs, 3);
+        assert_eq!(results.len(), inputs.len());
+        for (i, res) in results.iter().enumerate() {
+            assert_eq!(res.is_err(), i == 2, "{}", i);
+        }
+        assert_eq!(results[3].as_ref().unwrap().body().len(), 1);
+        assert!(results[4].as_ref().unwrap().body().is_empty());
+    }
+
+    #[test]
+    fn no_inputs() {
+        assert!(parse_batch::<&str>(&[], 4).is_empty());
+    }
+}
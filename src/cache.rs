@@ -0,0 +1,156 @@
+//! A content-addressed on-disk cache of parsed programs.
+//!
+//! Entries are keyed by a hash of the script source and hold the program in
+//! the format of the `serialize` module. Each entry also holds the source
+//! itself, which is compared before the program is used, so hash collisions
+//! are misses. Entries are mapped into memory to be decoded, so a cache hit
+//! costs no read copy and no lexing.
+
+use std::fs::{self, File};
+use std::io::{self, Write};
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+use crate::mapping::Mapping;
+use crate::parser::{ParseError, Program};
+use crate::serialize::{deserialize, serialize};
+
+/// Size of the fixed part of the entry header: source length and source
+/// hash. The source follows it.
+const HEADER_LEN: usize = 16;
+
+/// Distinguishes the temporary files of concurrent stores in this process.
+static TMP_COUNTER: AtomicUsize = AtomicUsize::new(0);
+
+pub struct ScriptCache {
+    dir: PathBuf,
+}
+
+impl ScriptCache {
+    /// Open a cache rooted at `dir`, creating the directory if needed.
+    pub fn new<P: Into<PathBuf>>(dir: P) -> io::Result<ScriptCache> {
+        let dir = dir.into();
+        fs::create_dir_all(&dir)?;
+        Ok(ScriptCache { dir })
+    }
+
+    pub fn dir(&self) -> &Path {
+        &self.dir
+    }
+
+    /// Parse `src`, or load it from the cache if it has been parsed before.
+    /// Successful parses are added to the cache; failing to write an entry is
+    /// not an error.
+    pub fn parse(&self, src: &[u8]) -> Result<Program, ParseError> {
+        if let Some(prog) = self.load(src) {
+            return Ok(prog);
+        }
+        let prog = Program::parse(src)?;
+        let _ = self.store(src, &prog);
+        Ok(prog)
+    }
+
+    /// Look up the program for `src`. Missing, stale and corrupt entries all
+    /// count as misses.
+    pub fn load(&self, src: &[u8]) -> Option<Program> {
+        let hash = content_hash(src);
+        let file = File::open(self.entry_path(hash)).ok()?;
+        let data = Mapping::new(&file).ok()?;
+        let body = HEADER_LEN + src.len();
+        if data.len() < body
+            || data[..HEADER_LEN] != header(src.len(), hash)
+            || &data[HEADER_LEN..body] != src
+        {
+            return None;
+        }
+        deserialize(&data[body..]).ok()
+    }
+
+    /// Add the program parsed from `src` to the cache.
+    pub fn store(&self, src: &[u8], prog: &Program) -> io::Result<()> {
+        let hash = content_hash(src);
+        let path = self.entry_path(hash);
+        // Write to a temporary file first so that concurrent readers never
+        // see a partial entry
+        let tmp = path.with_extension(format!(
+            "tmp{}-{}",
+            std::process::id(),
+            TMP_COUNTER.fetch_add(1, Ordering::Relaxed)
+        ));
+        let res = (|| {
+            let mut file = File::create(&tmp)?;
+            file.write_all(&header(src.len(), hash))?;
+            file.write_all(src)?;
+            file.write_all(&serialize(prog))?;
+            fs::rename(&tmp, &path)
+        })();
+        if res.is_err() {
+            let _ = fs::remove_file(&tmp);
+        }
+        res
+    }
+
+    fn entry_path(&self, hash: u64) -> PathBuf {
+        self.dir.join(format!("{:016x}.ast", hash))
+    }
+}
+
+fn header(len: usize, hash: u64) -> [u8; HEADER_LEN] {
+    let mut buf = [0; HEADER_LEN];
+    buf[..8].copy_from_slice(&(len as u64).to_le_bytes());
+    buf[8..].copy_from_slice(&hash.to_le_bytes());
+    buf
+}
+
+/// 64-bit FNV-1a.
+fn content_hash(data: &[u8]) -> u64 {
+    let mut hash = 0xcbf2_9ce4_8422_2325u64;
+    for &b in data {
+        hash ^= b as u64;
+        hash = hash.wrapping_mul(0x0100_0000_01b3);
+    }
+    hash
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn temp_cache(name: &str) -> ScriptCache {
+        let dir = std::env::temp_dir().join(format!("mrsh-cache-{}-{}", name, std::process::id()));
+        let _ = fs::remove_dir_all(&dir);
+        ScriptCache::new(dir).unwrap()
+    }
+
+    #[test]
+    fn hit_and_miss() {
+        let cache = temp_cache("hit");
+        assert!(cache.load(b"echo a").is_none());
+        cache.parse(b"echo a").unwrap();
+        assert!(cache.load(b"echo a").is_some());
+        assert!(cache.load(b"echo b").is_none());
+        fs::remove_dir_all(cache.dir()).unwrap();
+    }
+
+    /// Write an entry for `src` by hand, under the key `hash`.
+    fn write_entry(cache: &ScriptCache, hash: u64, src: &[u8]) {
+        let prog = Program::parse(src).unwrap();
+        let mut data = header(src.len(), hash).to_vec();
+        data.extend_from_slice(src);
+        data.extend_from_slice(&serialize(&prog));
+        fs::write(cache.entry_path(hash), data).unwrap();
+    }
+
+    #[test]
+    fn hash_collision_is_a_miss() {
+        let cache = temp_cache("collision");
+        write_entry(&cache, content_hash(b"echo a"), b"echo a");
+        assert!(cache.load(b"echo a").is_some());
+        // An entry for "echo a" whose header says it hashes like "echo b",
+        // which has the same length, so only the source comparison tells
+        // them apart
+        write_entry(&cache, content_hash(b"echo b"), b"echo a");
+        assert!(cache.load(b"echo b").is_none());
+        fs::remove_dir_all(cache.dir()).unwrap();
+    }
+}
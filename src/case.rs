@@ -0,0 +1,405 @@
+//! Compiled dispatch for `case` clauses whose patterns are all static.
+//!
+//! Literal patterns go into a hash map and the remaining globs are compiled to
+//! atom lists, so a word is looked up once instead of being matched against
+//! every item in turn.
+
+use std::collections::HashMap;
+use std::ffi::{CStr, CString};
+use std::marker::PhantomData;
+
+use crate::parser::{array_slice, Program};
+use crate::sys;
+
+#[derive(Clone)]
+enum Atom {
+    Byte(u8),
+    Any,
+    Star,
+    Class { negate: bool, set: [u64; 4] },
+}
+
+impl Atom {
+    fn matches(&self, c: u8) -> bool {
+        match *self {
+            Atom::Byte(b) => b == c,
+            Atom::Any => true,
+            Atom::Star => false,
+            Atom::Class { negate, ref set } => {
+                (set[c as usize / 64] & (1 << (c % 64)) != 0) != negate
+            }
+        }
+    }
+}
+
+struct Glob {
+    atoms: Vec<Atom>,
+    /// The same pattern for fnmatch, with quoted characters escaped.
+    pattern: CString,
+    item: usize,
+}
+
+impl Glob {
+    fn matches(&self, s: &[u8]) -> bool {
+        let atoms = &self.atoms;
+        let (mut p, mut i) = (0, 0);
+        // Where to resume after the last `*`: the atom after it and the
+        // first byte it has not consumed yet
+        let mut star = None;
+        while i < s.len() {
+            if p < atoms.len() {
+                if let Atom::Star = atoms[p] {
+                    p += 1;
+                    star = Some((p, i));
+                    continue;
+                }
+                if atoms[p].matches(s[i]) {
+                    p += 1;
+                    i += 1;
+                    continue;
+                }
+            }
+            match star {
+                Some((sp, si)) => {
+                    p = sp;
+                    i = si + 1;
+                    star = Some((sp, si + 1));
+                }
+                None => return false,
+            }
+        }
+        atoms[p..].iter().all(|a| matches!(a, Atom::Star))
+    }
+
+    fn fnmatch(&self, s: &[u8]) -> bool {
+        let s = match CString::new(s) {
+            Ok(s) => s,
+            Err(_) => return false,
+        };
+        unsafe { libc::fnmatch(self.pattern.as_ptr(), s.as_ptr(), 0) == 0 }
+    }
+
+    fn is_bytewise(&self) -> bool {
+        self.atoms
+            .iter()
+            .all(|a| matches!(a, Atom::Byte(_) | Atom::Star))
+    }
+}
+
+/// The items of a `case` clause compiled into one matcher.
+pub struct CompiledCase {
+    literals: HashMap<Vec<u8>, usize>,
+    /// Sorted by item index
+    globs: Vec<Glob>,
+    /// Whether every glob matches byte by byte, so that non-ASCII words
+    /// don't need fnmatch's multibyte handling.
+    bytewise: bool,
+}
+
+impl CompiledCase {
+    /// Compile a `case` clause. Returns None if a pattern has to be expanded
+    /// first (e.g. `$prefix*`) or uses syntax the matcher doesn't handle;
+    /// these clauses keep going through the shell.
+    pub fn compile(clause: &sys::mrsh_case_clause) -> Option<CompiledCase> {
+        let mut literals = HashMap::new();
+        let mut globs = Vec::new();
+        let items = unsafe { array_slice::<sys::mrsh_case_item>(&clause.items) };
+        for (i, &item) in items.iter().enumerate() {
+            let patterns = unsafe { array_slice::<sys::mrsh_word>(&(*item).patterns) };
+            for &word in patterns {
+                let mut glob = Glob {
+                    atoms: Vec::new(),
+                    pattern: CString::default(),
+                    item: i,
+                };
+                let mut pattern = Vec::new();
+                unsafe { compile_word(word, false, &mut glob.atoms, &mut pattern)? };
+                if glob.atoms.iter().all(|a| matches!(a, Atom::Byte(_))) {
+                    let literal = glob
+                        .atoms
+                        .iter()
+                        .map(|a| match *a {
+                            Atom::Byte(b) => b,
+                            _ => unreachable!(),
+                        })
+                        .collect();
+                    literals.entry(literal).or_insert(i);
+                } else {
+                    glob.pattern = CString::new(pattern).ok()?;
+                    globs.push(glob);
+                }
+            }
+        }
+        let bytewise = globs.iter().all(Glob::is_bytewise);
+        Some(CompiledCase {
+            literals,
+            globs,
+            bytewise,
+        })
+    }
+
+    /// The index of the first item with a pattern matching `word`, which is
+    /// the expanded subject of the clause.
+    pub fn find(&self, word: &[u8]) -> Option<usize> {
+        let literal = self.literals.get(word).copied();
+        let limit = literal.unwrap_or(usize::MAX);
+        let fnmatch = !self.bytewise && !word.is_ascii();
+        self.globs
+            .iter()
+            .take_while(|g| g.item < limit)
+            .find(|g| {
+                if fnmatch {
+                    g.fnmatch(word)
+                } else {
+                    g.matches(word)
+                }
+            })
+            .map(|g| g.item)
+            .or(literal)
+    }
+}
+
+/// Append the atoms of a pattern word and its fnmatch form.
+unsafe fn compile_word(
+    word: *const sys::mrsh_word,
+    quoted: bool,
+    atoms: &mut Vec<Atom>,
+    pattern: &mut Vec<u8>,
+) -> Option<()> {
+    match (*word).type_ {
+        sys::MRSH_WORD_STRING => {
+            let ws = &*sys::mrsh_word_get_string(word);
+            let s = CStr::from_ptr(ws.str).to_bytes();
+            if quoted || ws.single_quoted {
+                for &c in s {
+                    if b"*?[]\\".contains(&c) {
+                        pattern.push(b'\\');
+                    }
+                    pattern.push(c);
+                    atoms.push(Atom::Byte(c));
+                }
+                Some(())
+            } else if pattern.is_empty() && s.first() == Some(&b'~') {
+                // Tilde expansion
+                None
+            } else {
+                pattern.extend_from_slice(s);
+                compile_glob(s, atoms)
+            }
+        }
+        sys::MRSH_WORD_LIST => {
+            let wl = &*sys::mrsh_word_get_list(word);
+            for &child in array_slice::<sys::mrsh_word>(&wl.children) {
+                compile_word(child, quoted || wl.double_quoted, atoms, pattern)?;
+            }
+            Some(())
+        }
+        _ => None,
+    }
+}
+
+fn compile_glob(s: &[u8], atoms: &mut Vec<Atom>) -> Option<()> {
+    let mut i = 0;
+    while i < s.len() {
+        match s[i] {
+            // Leave backslash escapes to the shell
+            b'\\' => return None,
+            b'*' => {
+                // `**` matches the same as `*`
+                if !matches!(atoms.last(), Some(Atom::Star)) {
+                    atoms.push(Atom::Star);
+                }
+            }
+            b'?' => atoms.push(Atom::Any),
+            b'[' => {
+                let (atom, len) = compile_bracket(&s[i + 1..])?;
+                atoms.push(atom);
+                i += len;
+            }
+            c => atoms.push(Atom::Byte(c)),
+        }
+        i += 1;
+    }
+    Some(())
+}
+
+/// Compile the bracket expression following a `[`. Returns the atom and the
+/// number of bytes consumed, including the closing `]`.
+fn compile_bracket(s: &[u8]) -> Option<(Atom, usize)> {
+    let mut set = [0u64; 4];
+    let mut add = |c: u8| set[c as usize / 64] |= 1 << (c % 64);
+
+    let mut i = 0;
+    let negate = matches!(s.first(), Some(b'!') | Some(b'^'));
+    if negate {
+        i += 1;
+    }
+    let start = i;
+    loop {
+        let c = *s.get(i)?;
+        if c == b']' && i > start {
+            break;
+        }
+        if c == b'[' && s.get(i + 1) == Some(&b':') {
+            let len = s[i + 2..].windows(2).position(|w| w == b":]")?;
+            let class = class(&s[i + 2..i + 2 + len])?;
+            (0..=255u8).filter(|&c| class(c)).for_each(&mut add);
+            i += len + 4;
+        } else if c == b'\\' || c == b'[' {
+            // Escapes, equivalence classes and collating symbols
+            return None;
+        } else if s.get(i + 1) == Some(&b'-') && s.get(i + 2).is_some_and(|&e| e != b']') {
+            (c..=s[i + 2]).for_each(&mut add);
+            i += 3;
+        } else {
+            add(c);
+            i += 1;
+        }
+    }
+    Some((Atom::Class { negate, set }, i + 1))
+}
+
+fn class(name: &[u8]) -> Option<fn(u8) -> bool> {
+    Some(match name {
+        b"alnum" => |c: u8| c.is_ascii_alphanumeric(),
+        b"alpha" => |c: u8| c.is_ascii_alphabetic(),
+        b"blank" => |c: u8| c == b' ' || c == b'\t',
+        b"cntrl" => |c: u8| c.is_ascii_control(),
+        b"digit" => |c: u8| c.is_ascii_digit(),
+        b"graph" => |c: u8| c.is_ascii_graphic(),
+        b"lower" => |c: u8| c.is_ascii_lowercase(),
+        b"print" => |c: u8| c.is_ascii_graphic() || c == b' ',
+        b"punct" => |c: u8| c.is_ascii_punctuation(),
+        b"space" => |c: u8| c.is_ascii_whitespace() || c == 0x0b,
+        b"upper" => |c: u8| c.is_ascii_uppercase(),
+        b"xdigit" => |c: u8| c.is_ascii_hexdigit(),
+        _ => return None,
+    })
+}
+
+/// Compiled forms of the `case` clauses of one program, built on first use.
+///
+/// Entries are keyed on the address of the `mrsh_case_clause` node, so the
+/// cache borrows the program it was created for.
+pub struct CaseCache<'p> {
+    compiled: HashMap<*const sys::mrsh_case_clause, Option<CompiledCase>>,
+    _prog: PhantomData<&'p Program>,
+}
+
+impl<'p> CaseCache<'p> {
+    pub fn new(_prog: &'p Program) -> CaseCache<'p> {
+        CaseCache {
+            compiled: HashMap::new(),
+            _prog: PhantomData,
+        }
+    }
+
+    /// Get the compiled form of a `case` clause of the program. Returns None
+    /// if one of its patterns is dynamic; see `CompiledCase::compile`.
+    pub fn get(&mut self, clause: &'p sys::mrsh_case_clause) -> Option<&CompiledCase> {
+        self.compiled
+            .entry(clause as *const _)
+            .or_insert_with(|| CompiledCase::compile(clause))
+            .as_ref()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Compile the clause `case x in <items> esac`.
+    fn compile(items: &str) -> Option<CompiledCase> {
+        let prog = Program::parse(format!("case x in {} esac", items).as_bytes()).unwrap();
+        unsafe {
+            let l = prog.body()[0];
+            let pl = &*sys::mrsh_and_or_list_get_pipeline((*l).and_or_list);
+            let cmd = array_slice::<sys::mrsh_command>(&pl.commands)[0];
+            CompiledCase::compile(&*sys::mrsh_command_get_case_clause(cmd))
+        }
+    }
+
+    #[test]
+    fn literals() {
+        let c = compile("a) ;; 'b*') ;; \"c?\"|a) ;; b*) ;;").unwrap();
+        assert_eq!(c.find(b"a"), Some(0));
+        assert_eq!(c.find(b"b*"), Some(1));
+        assert_eq!(c.find(b"bx"), Some(3));
+        assert_eq!(c.find(b"c?"), Some(2));
+        assert_eq!(c.find(b"cx"), None);
+    }
+
+    #[test]
+    fn bracket_ranges() {
+        let c = compile("[a-c]x) ;; [[:digit:]_]) ;; [-z]) ;; []a]) ;;").unwrap();
+        assert_eq!(c.find(b"ax"), Some(0));
+        assert_eq!(c.find(b"cx"), Some(0));
+        assert_eq!(c.find(b"dx"), None);
+        assert_eq!(c.find(b"7"), Some(1));
+        assert_eq!(c.find(b"_"), Some(1));
+        assert_eq!(c.find(b"-"), Some(2));
+        assert_eq!(c.find(b"z"), Some(2));
+        assert_eq!(c.find(b"]"), Some(3));
+        assert_eq!(c.find(b"y"), None);
+    }
+
+    #[test]
+    fn negation() {
+        let c = compile("[!a-c]) ;; [^x]y) ;;").unwrap();
+        assert_eq!(c.find(b"d"), Some(0));
+        assert_eq!(c.find(b"b"), None);
+        assert_eq!(c.find(b"zy"), Some(1));
+        assert_eq!(c.find(b"xy"), None);
+    }
+
+    #[test]
+    fn star_backtracking() {
+        let c = compile("*ab*ab) ;; a*) ;;").unwrap();
+        assert_eq!(c.find(b"abab"), Some(0));
+        assert_eq!(c.find(b"xabyabab"), Some(0));
+        assert_eq!(c.find(b"aab"), Some(1));
+        assert_eq!(c.find(b"xaba"), None);
+        let c = compile("**) ;;").unwrap();
+        assert_eq!(c.find(b""), Some(0));
+    }
+
+    #[test]
+    fn non_ascii() {
+        // Byte-wise globs don't need fnmatch
+        let c = compile("*\u{e9}) ;; \u{e9}t\u{e9}) ;;").unwrap();
+        assert_eq!(c.find("caf\u{e9}".as_bytes()), Some(0));
+        assert_eq!(c.find("\u{e9}t\u{e9}".as_bytes()), Some(0));
+
+        // `?` is one character, not one byte
+        let c = compile("a?c) ;;").unwrap();
+        assert_eq!(c.find(b"abc"), Some(0));
+        // uselocale only affects this thread, not the other tests
+        let utf8 = unsafe {
+            libc::newlocale(
+                libc::LC_CTYPE_MASK,
+                b"C.UTF-8\0".as_ptr().cast(),
+                std::ptr::null_mut(),
+            )
+        };
+        if !utf8.is_null() {
+            let found = unsafe {
+                let old = libc::uselocale(utf8);
+                let found = c.find("a\u{e9}c".as_bytes());
+                libc::uselocale(old);
+                libc::freelocale(utf8);
+                found
+            };
+            assert_eq!(found, Some(0));
+        }
+    }
+
+    #[test]
+    fn dynamic_patterns() {
+        assert!(compile("$x) ;;").is_none());
+        assert!(compile("a\\*) ;;").is_none());
+        assert!(compile("~) ;;").is_none());
+        assert!(compile("~/x) ;;").is_none());
+        assert!(compile("'~') ;;").is_some());
+        assert!(compile("a~) ;;").is_some());
+    }
+}
@@ -0,0 +1,568 @@
+//! Incremental reparsing.
+//!
+//! After an edit, only the top-level command lists whose source overlaps the
+//! edit are parsed again. The lists before the edit are kept as they are, the
+//! lists after it are kept with their positions shifted.
+//!
+//! Each list owns the text from its first byte up to the first byte of the
+//! next list (or the end of the source), which covers separators, comments
+//! and here-document bodies. Edits near lists with here-documents are
+//! reparsed in full, since a body isn't in the text of the list it belongs
+//! to.
+
+use crate::parser::{array_slice, ParseError, Program};
+use crate::sys;
+
+/// An edit applied to the source a program was parsed from, in bytes.
+/// `start..old_end` in the old source was replaced by `start..new_end` in the
+/// new source.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Edit {
+    pub start: usize,
+    pub old_end: usize,
+    pub new_end: usize,
+}
+
+impl Program {
+    /// Bring the program up to date with `src`, the new source after `edit`.
+    ///
+    /// Falls back to parsing `src` entirely when the edit can't be contained
+    /// in a run of top-level command lists, e.g. when it opens a compound
+    /// command that the following lines close. On error, the program is left
+    /// unchanged.
+    pub fn reparse(&mut self, src: &[u8], edit: &Edit) -> Result<(), ParseError> {
+        if let Some(res) = unsafe { self.reparse_lists(src, edit) } {
+            return res;
+        }
+        *self = Program::parse(src)?;
+        Ok(())
+    }
+
+    /// Returns None if a full reparse is needed.
+    unsafe fn reparse_lists(&mut self, src: &[u8], edit: &Edit) -> Option<Result<(), ParseError>> {
+        if edit.start > edit.old_end || edit.start > edit.new_end || edit.new_end > src.len() {
+            return None;
+        }
+        let lists = self.body().to_vec();
+        let begins = lists
+            .iter()
+            .map(|&l| command_list_begin(l))
+            .collect::<Option<Vec<_>>>()?;
+        if lists.is_empty() {
+            return None;
+        }
+
+        // First and last lists whose text touches the edit. The first list
+        // also owns the text before it.
+        let owned_end = |i: usize| begins.get(i + 1).map_or(usize::MAX, |p| p.offset);
+        let first = (0..lists.len()).find(|&i| edit.start < owned_end(i))?;
+        let mut last = (first..lists.len())
+            .take_while(|&i| i == first || begins[i].offset <= edit.old_end)
+            .last()?;
+        // An edit to the separator or the text after a list can join it with
+        // the next one, e.g. deleting the `;` of `a; b`
+        while last + 1 < lists.len() && edit.old_end > command_list_end(lists[last])?.offset {
+            last += 1;
+        }
+
+        // Here-document bodies come after the line their operator is on, so
+        // they are in the text of a later list
+        let line = begins[first].line;
+        let before = lists[..first]
+            .iter()
+            .zip(&begins[..first])
+            .rev()
+            .take_while(|(_, begin)| begin.line == line);
+        for (&l, _) in before.chain(lists[first..=last].iter().zip(&begins[first..])) {
+            if has_here_document(l) {
+                return None;
+            }
+        }
+
+        let start = if first == 0 {
+            sys::mrsh_position {
+                offset: 0,
+                line: 1,
+                column: 1,
+            }
+        } else {
+            begins[first]
+        };
+        let delta = edit.new_end as isize - edit.old_end as isize;
+        let (end, next) = match begins.get(last + 1) {
+            Some(next) => ((next.offset as isize + delta) as usize, Some(*next)),
+            None => (src.len(), None),
+        };
+        if end < start.offset || end > src.len() {
+            return None;
+        }
+        let text = &src[start.offset..end];
+        // A trailing line continuation would join the next list in a full
+        // parse
+        if text.ends_with(b"\\\n") {
+            return None;
+        }
+
+        let slice = match Program::parse(text) {
+            Ok(slice) => slice,
+            Err(_) => return None,
+        };
+        let new_lists = slice.body().to_vec();
+        // The slice has to end on a list terminator, or the next list would
+        // have continued it
+        if next.is_some() {
+            if let Some(&l) = new_lists.last() {
+                if !is_terminated(l, text) {
+                    return None;
+                }
+            }
+        }
+        if new_lists.iter().any(|&l| has_here_document(l)) {
+            return None;
+        }
+        (*slice.as_ptr()).body.len = 0;
+        drop(slice);
+
+        for &l in &new_lists {
+            for_each_position(l, &mut |pos| {
+                if pos.line == 1 {
+                    pos.column += start.column - 1;
+                }
+                pos.line += start.line - 1;
+                pos.offset += start.offset;
+            });
+        }
+
+        if let Some(next) = next {
+            let new_next = advance(start, text);
+            let (line_delta, column_delta) =
+                (new_next.line - next.line, new_next.column - next.column);
+            for &l in &lists[last + 1..] {
+                for_each_position(l, &mut |pos| {
+                    if pos.line == next.line {
+                        pos.column += column_delta;
+                    }
+                    pos.line += line_delta;
+                    pos.offset = (pos.offset as isize + delta) as usize;
+                });
+            }
+        }
+
+        for &l in &lists[first..=last] {
+            sys::mrsh_command_list_destroy(l);
+        }
+        let body = &mut (*self.as_ptr()).body;
+        body.len = 0;
+        for &l in lists[..first]
+            .iter()
+            .chain(&new_lists)
+            .chain(&lists[last + 1..])
+        {
+            sys::mrsh_array_add(body, l.cast());
+        }
+        Some(Ok(()))
+    }
+}
+
+/// The position right after `text`, which starts at `pos`.
+fn advance(mut pos: sys::mrsh_position, text: &[u8]) -> sys::mrsh_position {
+    for &b in text {
+        pos.offset += 1;
+        if b == b'\n' {
+            pos.line += 1;
+            pos.column = 1;
+        } else {
+            pos.column += 1;
+        }
+    }
+    pos
+}
+
+unsafe fn command_list_begin(l: *const sys::mrsh_command_list) -> Option<sys::mrsh_position> {
+    let mut and_or_list = (*l).and_or_list;
+    while (*and_or_list).type_ == sys::MRSH_AND_OR_LIST_BINOP {
+        and_or_list = (*sys::mrsh_and_or_list_get_binop(and_or_list)).left;
+    }
+    let pl = &*sys::mrsh_and_or_list_get_pipeline(and_or_list);
+    if sys::mrsh_position_valid(&pl.bang_pos) {
+        return Some(pl.bang_pos);
+    }
+    let cmd = *array_slice::<sys::mrsh_command>(&pl.commands).first()?;
+    let mut begin = sys::mrsh_position {
+        offset: 0,
+        line: 0,
+        column: 0,
+    };
+    let mut end = begin;
+    sys::mrsh_command_range(cmd, &mut begin, &mut end);
+    if sys::mrsh_position_valid(&begin) {
+        Some(begin)
+    } else {
+        None
+    }
+}
+
+/// The end of the last command of a list, before its separator.
+unsafe fn command_list_end(l: *const sys::mrsh_command_list) -> Option<sys::mrsh_position> {
+    let mut and_or_list = (*l).and_or_list;
+    while (*and_or_list).type_ == sys::MRSH_AND_OR_LIST_BINOP {
+        and_or_list = (*sys::mrsh_and_or_list_get_binop(and_or_list)).right;
+    }
+    let pl = &*sys::mrsh_and_or_list_get_pipeline(and_or_list);
+    let cmd = *array_slice::<sys::mrsh_command>(&pl.commands).last()?;
+    let mut begin = sys::mrsh_position {
+        offset: 0,
+        line: 0,
+        column: 0,
+    };
+    let mut end = begin;
+    sys::mrsh_command_range(cmd, &mut begin, &mut end);
+    if sys::mrsh_position_valid(&end) {
+        Some(end)
+    } else {
+        None
+    }
+}
+
+/// Whether a list parsed from `text` ends with `;`, `&` or a newline.
+unsafe fn is_terminated(l: *const sys::mrsh_command_list, text: &[u8]) -> bool {
+    if sys::mrsh_position_valid(&(*l).separator_pos) {
+        return true;
+    }
+    match command_list_end(l) {
+        Some(end) => text
+            .get(end.offset..)
+            .is_some_and(|rest| rest.contains(&b'\n')),
+        None => false,
+    }
+}
+
+/// Whether a list has a here-document outside of command substitutions.
+unsafe fn has_here_document(l: *const sys::mrsh_command_list) -> bool {
+    and_or_list_has_here_document((*l).and_or_list)
+}
+
+unsafe fn and_or_list_has_here_document(and_or_list: *const sys::mrsh_and_or_list) -> bool {
+    match (*and_or_list).type_ {
+        sys::MRSH_AND_OR_LIST_PIPELINE => {
+            let pl = &*sys::mrsh_and_or_list_get_pipeline(and_or_list);
+            array_slice::<sys::mrsh_command>(&pl.commands)
+                .iter()
+                .any(|&cmd| command_has_here_document(cmd))
+        }
+        sys::MRSH_AND_OR_LIST_BINOP => {
+            let binop = &*sys::mrsh_and_or_list_get_binop(and_or_list);
+            and_or_list_has_here_document(binop.left) || and_or_list_has_here_document(binop.right)
+        }
+        _ => unreachable!(),
+    }
+}
+
+unsafe fn command_lists_have_here_document(array: &sys::mrsh_array) -> bool {
+    array_slice::<sys::mrsh_command_list>(array)
+        .iter()
+        .any(|&l| has_here_document(l))
+}
+
+unsafe fn io_redirects_have_here_document(array: &sys::mrsh_array) -> bool {
+    array_slice::<sys::mrsh_io_redirect>(array)
+        .iter()
+        .any(|&redir| matches!((*redir).op, sys::MRSH_IO_DLESS | sys::MRSH_IO_DLESSDASH))
+}
+
+unsafe fn command_has_here_document(cmd: *const sys::mrsh_command) -> bool {
+    if cmd.is_null() {
+        return false;
+    }
+    match (*cmd).type_ {
+        sys::MRSH_SIMPLE_COMMAND => {
+            let sc = &*sys::mrsh_command_get_simple_command(cmd);
+            io_redirects_have_here_document(&sc.io_redirects)
+        }
+        sys::MRSH_BRACE_GROUP => {
+            command_lists_have_here_document(&(*sys::mrsh_command_get_brace_group(cmd)).body)
+        }
+        sys::MRSH_SUBSHELL => {
+            command_lists_have_here_document(&(*sys::mrsh_command_get_subshell(cmd)).body)
+        }
+        sys::MRSH_IF_CLAUSE => {
+            let ic = &*sys::mrsh_command_get_if_clause(cmd);
+            command_lists_have_here_document(&ic.condition)
+                || command_lists_have_here_document(&ic.body)
+                || command_has_here_document(ic.else_part)
+        }
+        sys::MRSH_FOR_CLAUSE => {
+            command_lists_have_here_document(&(*sys::mrsh_command_get_for_clause(cmd)).body)
+        }
+        sys::MRSH_LOOP_CLAUSE => {
+            let lc = &*sys::mrsh_command_get_loop_clause(cmd);
+            command_lists_have_here_document(&lc.condition)
+                || command_lists_have_here_document(&lc.body)
+        }
+        sys::MRSH_CASE_CLAUSE => {
+            let cc = &*sys::mrsh_command_get_case_clause(cmd);
+            array_slice::<sys::mrsh_case_item>(&cc.items)
+                .iter()
+                .any(|&item| command_lists_have_here_document(&(*item).body))
+        }
+        sys::MRSH_FUNCTION_DEFINITION => {
+            let fd = &*sys::mrsh_command_get_function_definition(cmd);
+            command_has_here_document(fd.body) || io_redirects_have_here_document(&fd.io_redirects)
+        }
+        _ => unreachable!(),
+    }
+}
+
+type PositionFn<'a> = dyn FnMut(&mut sys::mrsh_position) + 'a;
+
+/// Call `f` on every valid position of a command list.
+pub(crate) unsafe fn for_each_position(l: *mut sys::mrsh_command_list, f: &mut PositionFn) {
+    and_or_list_positions((*l).and_or_list, f);
+    position(&mut (*l).separator_pos, f);
+}
+
+unsafe fn position(pos: &mut sys::mrsh_position, f: &mut PositionFn) {
+    if sys::mrsh_position_valid(pos) {
+        f(pos);
+    }
+}
+
+unsafe fn range(range: &mut sys::mrsh_range, f: &mut PositionFn) {
+    position(&mut range.begin, f);
+    position(&mut range.end, f);
+}
+
+unsafe fn command_lists(array: &sys::mrsh_array, f: &mut PositionFn) {
+    for &l in array_slice::<sys::mrsh_command_list>(array) {
+        for_each_position(l, f);
+    }
+}
+
+unsafe fn words(array: &sys::mrsh_array, f: &mut PositionFn) {
+    for &word in array_slice::<sys::mrsh_word>(array) {
+        word_positions(word, f);
+    }
+}
+
+unsafe fn io_redirects(array: &sys::mrsh_array, f: &mut PositionFn) {
+    for &redir in array_slice::<sys::mrsh_io_redirect>(array) {
+        let redir = &mut *redir;
+        word_positions(redir.name, f);
+        words(&redir.here_document, f);
+        position(&mut redir.io_number_pos, f);
+        range(&mut redir.op_range, f);
+    }
+}
+
+unsafe fn and_or_list_positions(and_or_list: *mut sys::mrsh_and_or_list, f: &mut PositionFn) {
+    match (*and_or_list).type_ {
+        sys::MRSH_AND_OR_LIST_PIPELINE => {
+            let pl = &mut *sys::mrsh_and_or_list_get_pipeline(and_or_list);
+            for &cmd in array_slice::<sys::mrsh_command>(&pl.commands) {
+                command_positions(cmd, f);
+            }
+            position(&mut pl.bang_pos, f);
+        }
+        sys::MRSH_AND_OR_LIST_BINOP => {
+            let binop = &mut *sys::mrsh_and_or_list_get_binop(and_or_list);
+            and_or_list_positions(binop.left, f);
+            and_or_list_positions(binop.right, f);
+            range(&mut binop.op_range, f);
+        }
+        _ => unreachable!(),
+    }
+}
+
+unsafe fn command_positions(cmd: *mut sys::mrsh_command, f: &mut PositionFn) {
+    if cmd.is_null() {
+        return;
+    }
+    match (*cmd).type_ {
+        sys::MRSH_SIMPLE_COMMAND => {
+            let sc = &mut *sys::mrsh_command_get_simple_command(cmd);
+            word_positions(sc.name, f);
+            words(&sc.arguments, f);
+            io_redirects(&sc.io_redirects, f);
+            for &assign in array_slice::<sys::mrsh_assignment>(&sc.assignments) {
+                let assign = &mut *assign;
+                word_positions(assign.value, f);
+                range(&mut assign.name_range, f);
+                position(&mut assign.equal_pos, f);
+            }
+        }
+        sys::MRSH_BRACE_GROUP => {
+            let bg = &mut *sys::mrsh_command_get_brace_group(cmd);
+            command_lists(&bg.body, f);
+            position(&mut bg.lbrace_pos, f);
+            position(&mut bg.rbrace_pos, f);
+        }
+        sys::MRSH_SUBSHELL => {
+            let s = &mut *sys::mrsh_command_get_subshell(cmd);
+            command_lists(&s.body, f);
+            position(&mut s.lparen_pos, f);
+            position(&mut s.rparen_pos, f);
+        }
+        sys::MRSH_IF_CLAUSE => {
+            let ic = &mut *sys::mrsh_command_get_if_clause(cmd);
+            command_lists(&ic.condition, f);
+            command_lists(&ic.body, f);
+            command_positions(ic.else_part, f);
+            range(&mut ic.if_range, f);
+            range(&mut ic.then_range, f);
+            range(&mut ic.fi_range, f);
+            range(&mut ic.else_range, f);
+        }
+        sys::MRSH_FOR_CLAUSE => {
+            let fc = &mut *sys::mrsh_command_get_for_clause(cmd);
+            words(&fc.word_list, f);
+            command_lists(&fc.body, f);
+            range(&mut fc.for_range, f);
+            range(&mut fc.name_range, f);
+            range(&mut fc.do_range, f);
+            range(&mut fc.done_range, f);
+            range(&mut fc.in_range, f);
+        }
+        sys::MRSH_LOOP_CLAUSE => {
+            let lc = &mut *sys::mrsh_command_get_loop_clause(cmd);
+            command_lists(&lc.condition, f);
+            command_lists(&lc.body, f);
+            range(&mut lc.while_until_range, f);
+            range(&mut lc.do_range, f);
+            range(&mut lc.done_range, f);
+        }
+        sys::MRSH_CASE_CLAUSE => {
+            let cc = &mut *sys::mrsh_command_get_case_clause(cmd);
+            word_positions(cc.word, f);
+            for &item in array_slice::<sys::mrsh_case_item>(&cc.items) {
+                let item = &mut *item;
+                words(&item.patterns, f);
+                command_lists(&item.body, f);
+                position(&mut item.lparen_pos, f);
+                position(&mut item.rparen_pos, f);
+                range(&mut item.dsemi_range, f);
+            }
+            range(&mut cc.case_range, f);
+            range(&mut cc.in_range, f);
+            range(&mut cc.esac_range, f);
+        }
+        sys::MRSH_FUNCTION_DEFINITION => {
+            let fd = &mut *sys::mrsh_command_get_function_definition(cmd);
+            command_positions(fd.body, f);
+            io_redirects(&fd.io_redirects, f);
+            range(&mut fd.name_range, f);
+            position(&mut fd.lparen_pos, f);
+            position(&mut fd.rparen_pos, f);
+        }
+        _ => unreachable!(),
+    }
+}
+
+unsafe fn word_positions(word: *mut sys::mrsh_word, f: &mut PositionFn) {
+    if word.is_null() {
+        return;
+    }
+    match (*word).type_ {
+        sys::MRSH_WORD_STRING => {
+            let ws = &mut *sys::mrsh_word_get_string(word);
+            range(&mut ws.range, f);
+        }
+        sys::MRSH_WORD_PARAMETER => {
+            let wp = &mut *sys::mrsh_word_get_parameter(word);
+            word_positions(wp.arg, f);
+            position(&mut wp.dollar_pos, f);
+            range(&mut wp.name_range, f);
+            range(&mut wp.op_range, f);
+            position(&mut wp.lbrace_pos, f);
+            position(&mut wp.rbrace_pos, f);
+        }
+        sys::MRSH_WORD_COMMAND => {
+            let wc = &mut *sys::mrsh_word_get_command(word);
+            if !wc.program.is_null() {
+                command_lists(&(*wc.program).body, f);
+            }
+            range(&mut wc.range, f);
+        }
+        sys::MRSH_WORD_ARITHMETIC => {
+            let wa = &mut *sys::mrsh_word_get_arithmetic(word);
+            word_positions(wa.body, f);
+        }
+        sys::MRSH_WORD_LIST => {
+            let wl = &mut *sys::mrsh_word_get_list(word);
+            words(&wl.children, f);
+            position(&mut wl.lquote_pos, f);
+            position(&mut wl.rquote_pos, f);
+        }
+        _ => unreachable!(),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::serialize::serialize;
+
+    /// Replace `start..old_end` of `old` with `text`, and check that the
+    /// reparsed program is the same as a full parse of the new source.
+    /// Returns how many lists of the old program were kept as they were, or
+    /// None if it had to be parsed in full.
+    fn check(old: &str, start: usize, old_end: usize, text: &str) -> Option<usize> {
+        let new = format!("{}{}{}", &old[..start], text, &old[old_end..]);
+        let edit = Edit {
+            start,
+            old_end,
+            new_end: start + text.len(),
+        };
+        let mut prog = Program::parse(old.as_bytes()).unwrap();
+        let old_lists = prog.body().to_vec();
+        let kept = match unsafe { prog.reparse_lists(new.as_bytes(), &edit) } {
+            Some(res) => {
+                res.unwrap();
+                let kept = prog.body().iter().filter(|l| old_lists.contains(l));
+                Some(kept.count())
+            }
+            None => {
+                prog = Program::parse(new.as_bytes()).unwrap();
+                None
+            }
+        };
+        let full = Program::parse(new.as_bytes()).unwrap();
+        assert_eq!(serialize(&prog), serialize(&full), "{:?}", new);
+        kept
+    }
+
+    #[test]
+    fn edit_one_list() {
+        assert_eq!(check("echo a\necho b\necho c\n", 7, 11, "printf"), Some(2));
+        assert_eq!(check("echo a; echo b; echo c", 8, 14, "printf x"), Some(2));
+        assert_eq!(check("echo a\necho b\n", 14, 14, "echo c\n"), Some(1));
+    }
+
+    #[test]
+    fn delete_separator() {
+        assert_eq!(check("echo a; echo b; echo c", 6, 7, ""), Some(1));
+        assert_eq!(check("echo a & echo b\necho c", 7, 8, ""), Some(1));
+        assert_eq!(check("echo a\necho b\necho c", 6, 7, " "), Some(1));
+        assert_eq!(check("echo a; echo b; echo c", 6, 7, " \\\n"), Some(1));
+    }
+
+    #[test]
+    fn escape_separator() {
+        assert_eq!(check("echo a; echo b; echo c", 6, 6, "\\"), None);
+    }
+
+    #[test]
+    fn edit_here_document_body() {
+        let src = "cat <<EOF; echo b\nline 1\nEOF\necho c\n";
+        assert_eq!(check(src, 18, 24, "line 2"), None);
+        assert_eq!(check(src, 18, 24, "EOF\necho d"), None);
+        assert_eq!(check(src, 0, 3, "tac"), None);
+        let src = "cat <<EOF; echo b; echo c\nbody\nEOF\n";
+        assert_eq!(check(src, 26, 30, "x"), None);
+    }
+
+    #[test]
+    fn edit_after_here_document() {
+        let src = "cat <<EOF\nbody\nEOF\necho b\necho c\n";
+        assert_eq!(check(src, 26, 30, "printf"), Some(2));
+    }
+}
@@ -1 +1,26 @@
 pub extern crate mrsh_sys as sys;
+
+mod alias;
+mod arithm;
+mod batch;
+mod cache;
+mod case;
+mod incremental;
+mod mapping;
+mod parser;
+mod serialize;
+mod spawn;
+mod state;
+mod trace;
+
+pub use alias::AliasTable;
+pub use arithm::{ArithmCache, ArithmError, ArithmExpr, CompiledArithm};
+pub use batch::parse_batch;
+pub use cache::ScriptCache;
+pub use case::{CaseCache, CompiledCase};
+pub use incremental::Edit;
+pub use parser::{ParseError, Parser, Program};
+pub use serialize::{deserialize, serialize, DecodeError};
+pub use spawn::{Running, Wait};
+pub use state::State;
+pub use trace::{CpuTime, Profile, Trace};
@@ -0,0 +1,57 @@
+use std::fs::File;
+use std::io;
+use std::ops::Deref;
+use std::os::unix::io::AsRawFd;
+use std::ptr;
+use std::slice;
+
+/// A read-only private mapping of a whole file.
+pub(crate) struct Mapping {
+    ptr: *mut libc::c_void,
+    len: usize,
+}
+
+impl Mapping {
+    pub(crate) fn new(file: &File) -> io::Result<Mapping> {
+        let len = file.metadata()?.len() as usize;
+        if len == 0 {
+            return Ok(Mapping {
+                ptr: ptr::null_mut(),
+                len,
+            });
+        }
+        let ptr = unsafe {
+            libc::mmap(
+                ptr::null_mut(),
+                len,
+                libc::PROT_READ,
+                libc::MAP_PRIVATE,
+                file.as_raw_fd(),
+                0,
+            )
+        };
+        if ptr == libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+        Ok(Mapping { ptr, len })
+    }
+}
+
+impl Deref for Mapping {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        if self.len == 0 {
+            return &[];
+        }
+        unsafe { slice::from_raw_parts(self.ptr as *const u8, self.len) }
+    }
+}
+
+impl Drop for Mapping {
+    fn drop(&mut self) {
+        if self.len != 0 {
+            unsafe { libc::munmap(self.ptr, self.len) };
+        }
+    }
+}
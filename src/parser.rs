@@ -0,0 +1,278 @@
+use std::ffi::CStr;
+use std::fmt;
+use std::fs::File;
+use std::io::{self, Seek};
+use std::os::unix::io::{AsRawFd, RawFd};
+use std::ptr::NonNull;
+
+use crate::alias::AliasCache;
+use crate::mapping::Mapping;
+use crate::sys;
+
+/// A shell parser. Wraps `struct mrsh_parser`.
+pub struct Parser {
+    raw: NonNull<sys::mrsh_parser>,
+    // Kept open for parsers that read from it incrementally
+    file: Option<File>,
+    // Passed to the parser's alias callback
+    pub(crate) aliases: Option<Box<AliasCache>>,
+}
+
+impl Parser {
+    /// Create a parser over a copy of `data`.
+    pub fn from_bytes(data: &[u8]) -> Parser {
+        let raw = unsafe { sys::mrsh_parser_with_data(data.as_ptr().cast(), data.len()) };
+        Parser {
+            raw: NonNull::new(raw).expect("mrsh_parser_with_data failed"),
+            file: None,
+            aliases: None,
+        }
+    }
+
+    /// Create a parser reading from `fd`. The file descriptor is not closed
+    /// when the parser is dropped.
+    pub fn from_fd(fd: RawFd) -> Parser {
+        let raw = unsafe { sys::mrsh_parser_with_fd(fd) };
+        Parser {
+            raw: NonNull::new(raw).expect("mrsh_parser_with_fd failed"),
+            file: None,
+            aliases: None,
+        }
+    }
+
+    /// Create a parser reading from `file`.
+    ///
+    /// Regular files are mapped and handed to the parser in one piece, which
+    /// saves the read loop and the buffer regrowth of `mrsh_parser_with_fd`.
+    /// Pipes, ttys and other special files are read incrementally from the
+    /// file descriptor, which stays open as long as the parser.
+    ///
+    /// Either way, parsing starts at the file's current position. Positions
+    /// in the program are relative to it.
+    pub fn from_file(mut file: File) -> io::Result<Parser> {
+        if !file.metadata()?.file_type().is_file() {
+            let mut parser = Parser::from_fd(file.as_raw_fd());
+            parser.file = Some(file);
+            return Ok(parser);
+        }
+        let start = file.stream_position()? as usize;
+        let data = Mapping::new(&file)?;
+        Ok(Parser::from_bytes(data.get(start..).unwrap_or(&[])))
+    }
+
+    pub fn as_ptr(&self) -> *mut sys::mrsh_parser {
+        self.raw.as_ptr()
+    }
+
+    /// Parse a complete multi-line program.
+    pub fn parse_program(&mut self) -> Result<Program, ParseError> {
+        let prog = unsafe { sys::mrsh_parse_program(self.as_ptr()) };
+        self.finish(prog)
+    }
+
+    /// Parse a program line. Continuation lines are consumed.
+    pub fn parse_line(&mut self) -> Result<Program, ParseError> {
+        let prog = unsafe { sys::mrsh_parse_line(self.as_ptr()) };
+        self.finish(prog)
+    }
+
+    fn finish(&mut self, prog: *mut sys::mrsh_program) -> Result<Program, ParseError> {
+        if let Some(err) = self.error() {
+            if !prog.is_null() {
+                unsafe { sys::mrsh_program_destroy(prog) };
+            }
+            return Err(err);
+        }
+        // The parser returns NULL for empty input
+        let prog = if prog.is_null() {
+            unsafe { sys::mrsh_program_create() }
+        } else {
+            prog
+        };
+        Ok(unsafe { Program::from_raw(prog) })
+    }
+
+    /// The syntax error the parser stopped on, if any.
+    pub fn error(&self) -> Option<ParseError> {
+        let mut pos = sys::mrsh_position {
+            offset: 0,
+            line: 0,
+            column: 0,
+        };
+        let msg = unsafe { sys::mrsh_parser_error(self.as_ptr(), &mut pos) };
+        if msg.is_null() {
+            return None;
+        }
+        let message = unsafe { CStr::from_ptr(msg) }
+            .to_string_lossy()
+            .into_owned();
+        Some(ParseError {
+            message,
+            position: pos,
+        })
+    }
+
+    /// Check if the input has been completely consumed.
+    pub fn is_eof(&self) -> bool {
+        unsafe { sys::mrsh_parser_eof(self.as_ptr()) }
+    }
+
+    /// Check if the input ends on a continuation line.
+    pub fn is_continuation_line(&self) -> bool {
+        unsafe { sys::mrsh_parser_continuation_line(self.as_ptr()) }
+    }
+
+    /// Reset the parser state, e.g. after a syntax error.
+    pub fn reset(&mut self) {
+        unsafe { sys::mrsh_parser_reset(self.as_ptr()) }
+    }
+}
+
+impl Drop for Parser {
+    fn drop(&mut self) {
+        unsafe { sys::mrsh_parser_destroy(self.as_ptr()) }
+    }
+}
+
+/// A syntax error, with the position the parser stopped at.
+#[derive(Debug, Clone)]
+pub struct ParseError {
+    pub message: String,
+    pub position: sys::mrsh_position,
+}
+
+impl fmt::Display for ParseError {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        write!(
+            f,
+            "{}:{}: {}",
+            self.position.line, self.position.column, self.message
+        )
+    }
+}
+
+impl std::error::Error for ParseError {}
+
+/// An owned AST. Wraps `struct mrsh_program`; the whole tree is released in
+/// one `mrsh_program_destroy` when it is dropped.
+pub struct Program {
+    raw: NonNull<sys::mrsh_program>,
+}
+
+impl Program {
+    /// Parse `src` as a complete program.
+    pub fn parse(src: &[u8]) -> Result<Program, ParseError> {
+        Parser::from_bytes(src).parse_program()
+    }
+
+    /// Take ownership of a tree allocated by libmrsh.
+    ///
+    /// # Safety
+    ///
+    /// `raw` must be a valid, uniquely owned program that can be released with
+    /// `mrsh_program_destroy`.
+    pub unsafe fn from_raw(raw: *mut sys::mrsh_program) -> Program {
+        Program {
+            raw: NonNull::new(raw).expect("null mrsh_program"),
+        }
+    }
+
+    /// Give up ownership of the tree. The caller becomes responsible for
+    /// calling `mrsh_program_destroy`.
+    pub fn into_raw(self) -> *mut sys::mrsh_program {
+        let raw = self.raw.as_ptr();
+        std::mem::forget(self);
+        raw
+    }
+
+    pub fn as_ptr(&self) -> *mut sys::mrsh_program {
+        self.raw.as_ptr()
+    }
+
+    /// The top-level command lists.
+    pub fn body(&self) -> &[*mut sys::mrsh_command_list] {
+        unsafe { array_slice(&(*self.as_ptr()).body) }
+    }
+}
+
+// A program is a tree of heap nodes with no references to the parser or to
+// any shell state
+unsafe impl Send for Program {}
+
+impl Clone for Program {
+    /// Deep-copy the tree with `mrsh_program_copy`, e.g. to keep it around
+    /// after the source it was parsed from is gone.
+    fn clone(&self) -> Program {
+        unsafe { Program::from_raw(sys::mrsh_program_copy(self.as_ptr())) }
+    }
+}
+
+impl Drop for Program {
+    fn drop(&mut self) {
+        unsafe { sys::mrsh_program_destroy(self.as_ptr()) }
+    }
+}
+
+/// View the elements of an `mrsh_array` holding pointers to `T`.
+pub(crate) unsafe fn array_slice<T>(array: &sys::mrsh_array) -> &[*mut T] {
+    if array.len == 0 {
+        return &[];
+    }
+    std::slice::from_raw_parts(array.data as *const *mut T, array.len)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::serialize::serialize;
+    use std::fs;
+    use std::io::SeekFrom;
+    use std::path::PathBuf;
+
+    fn temp_file(name: &str, data: &[u8]) -> PathBuf {
+        let path =
+            std::env::temp_dir().join(format!("mrsh-parser-{}-{}", name, std::process::id()));
+        fs::write(&path, data).unwrap();
+        path
+    }
+
+    #[test]
+    fn from_regular_file() {
+        let src = b"echo a; echo b\nif x; then y; fi\n";
+        let path = temp_file("regular", src);
+        let prog = Parser::from_file(File::open(&path).unwrap())
+            .unwrap()
+            .parse_program()
+            .unwrap();
+        assert_eq!(serialize(&prog), serialize(&Program::parse(src).unwrap()));
+        fs::remove_file(&path).unwrap();
+    }
+
+    #[test]
+    fn from_empty_file() {
+        let path = temp_file("empty", b"");
+        let prog = Parser::from_file(File::open(&path).unwrap())
+            .unwrap()
+            .parse_program()
+            .unwrap();
+        assert!(prog.body().is_empty());
+        fs::remove_file(&path).unwrap();
+    }
+
+    #[test]
+    fn from_advanced_file() {
+        let path = temp_file("advanced", b"echo skipped\necho a; echo b\n");
+        let mut file = File::open(&path).unwrap();
+        file.seek(SeekFrom::Start(13)).unwrap();
+        let prog = Parser::from_file(file).unwrap().parse_program().unwrap();
+        let expected = Program::parse(b"echo a; echo b\n").unwrap();
+        assert_eq!(serialize(&prog), serialize(&expected));
+
+        // Past the end
+        let mut file = File::open(&path).unwrap();
+        file.seek(SeekFrom::Start(100)).unwrap();
+        let prog = Parser::from_file(file).unwrap().parse_program().unwrap();
+        assert!(prog.body().is_empty());
+        fs::remove_file(&path).unwrap();
+    }
+}
@@ -0,0 +1,851 @@
+//! A compact binary encoding of `struct mrsh_program`.
+//!
+//! The encoding is a pre-order walk of the tree. Every node starts with its
+//! type tag, integers are LEB128 varints and strings are length-prefixed. All
+//! source positions are kept, so a decoded tree is indistinguishable from the
+//! one the parser produced: it can be printed, walked or handed to
+//! `mrsh_run_program`.
+//!
+//! Decoding rebuilds the tree with libmrsh's own constructors instead of
+//! pointing into the input, because `mrsh_program_destroy` frees each node
+//! individually. It is a single linear pass with no lexing.
+
+use std::fmt;
+use std::mem;
+use std::os::raw::{c_char, c_int, c_uint};
+use std::ptr;
+
+use crate::parser::{array_slice, Program};
+use crate::sys;
+
+const MAGIC: &[u8; 8] = b"MRSHAST\0";
+const VERSION: u32 = 1;
+
+/// Tag used in place of a node for NULL pointers.
+const NONE: u8 = 0xff;
+
+/// Encode a program.
+pub fn serialize(prog: &Program) -> Vec<u8> {
+    let mut w = Writer { buf: Vec::new() };
+    w.buf.extend_from_slice(MAGIC);
+    w.buf.extend_from_slice(&VERSION.to_le_bytes());
+    unsafe { w.program(prog.as_ptr()) };
+    w.buf
+}
+
+/// Decode a program previously encoded with `serialize`.
+pub fn deserialize(data: &[u8]) -> Result<Program> {
+    if data.len() < MAGIC.len() + 4 || &data[..MAGIC.len()] != MAGIC {
+        return Err(DecodeError::BadHeader);
+    }
+    let mut version = [0; 4];
+    version.copy_from_slice(&data[MAGIC.len()..MAGIC.len() + 4]);
+    if u32::from_le_bytes(version) != VERSION {
+        return Err(DecodeError::BadHeader);
+    }
+
+    let mut r = Reader {
+        data,
+        pos: MAGIC.len() + 4,
+    };
+    let prog = unsafe { r.program()? };
+    if r.pos != data.len() {
+        return Err(DecodeError::TrailingData);
+    }
+    Ok(unsafe { Program::from_raw(prog.into_raw()) })
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DecodeError {
+    BadHeader,
+    UnexpectedEof,
+    InvalidTag(u8),
+    InvalidString,
+    TrailingData,
+}
+
+impl fmt::Display for DecodeError {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self {
+            DecodeError::BadHeader => f.write_str("not an encoded mrsh program"),
+            DecodeError::UnexpectedEof => f.write_str("unexpected end of data"),
+            DecodeError::InvalidTag(tag) => write!(f, "invalid node tag {}", tag),
+            DecodeError::InvalidString => f.write_str("string contains a NUL byte"),
+            DecodeError::TrailingData => f.write_str("trailing data after program"),
+        }
+    }
+}
+
+impl std::error::Error for DecodeError {}
+
+struct Writer {
+    buf: Vec<u8>,
+}
+
+impl Writer {
+    fn u8(&mut self, v: u8) {
+        self.buf.push(v);
+    }
+
+    fn bool(&mut self, v: bool) {
+        self.u8(v as u8);
+    }
+
+    fn uint(&mut self, mut v: u64) {
+        loop {
+            let byte = (v & 0x7f) as u8;
+            v >>= 7;
+            if v == 0 {
+                self.u8(byte);
+                return;
+            }
+            self.u8(byte | 0x80);
+        }
+    }
+
+    fn int(&mut self, v: i64) {
+        self.uint(((v << 1) ^ (v >> 63)) as u64);
+    }
+
+    unsafe fn str(&mut self, s: *const c_char) {
+        let bytes = std::ffi::CStr::from_ptr(s).to_bytes();
+        self.uint(bytes.len() as u64);
+        self.buf.extend_from_slice(bytes);
+    }
+
+    fn position(&mut self, pos: &sys::mrsh_position) {
+        self.uint(pos.offset as u64);
+        self.int(pos.line as i64);
+        self.int(pos.column as i64);
+    }
+
+    fn range(&mut self, range: &sys::mrsh_range) {
+        self.position(&range.begin);
+        self.position(&range.end);
+    }
+
+    unsafe fn array<T>(&mut self, array: &sys::mrsh_array, mut f: impl FnMut(&mut Self, *mut T)) {
+        let items = array_slice::<T>(array);
+        self.uint(items.len() as u64);
+        for &item in items {
+            f(self, item);
+        }
+    }
+
+    unsafe fn program(&mut self, prog: *const sys::mrsh_program) {
+        self.array(&(*prog).body, |w, l| w.command_list(l));
+    }
+
+    unsafe fn command_list(&mut self, l: *const sys::mrsh_command_list) {
+        self.and_or_list((*l).and_or_list);
+        self.bool((*l).ampersand);
+        self.position(&(*l).separator_pos);
+    }
+
+    unsafe fn and_or_list(&mut self, and_or_list: *const sys::mrsh_and_or_list) {
+        self.u8((*and_or_list).type_ as u8);
+        match (*and_or_list).type_ {
+            sys::MRSH_AND_OR_LIST_PIPELINE => {
+                let pl = &*sys::mrsh_and_or_list_get_pipeline(and_or_list);
+                self.array(&pl.commands, |w, cmd| w.command(cmd));
+                self.bool(pl.bang);
+                self.position(&pl.bang_pos);
+            }
+            sys::MRSH_AND_OR_LIST_BINOP => {
+                let binop = &*sys::mrsh_and_or_list_get_binop(and_or_list);
+                self.u8(binop.type_ as u8);
+                self.and_or_list(binop.left);
+                self.and_or_list(binop.right);
+                self.range(&binop.op_range);
+            }
+            _ => unreachable!(),
+        }
+    }
+
+    unsafe fn command(&mut self, cmd: *const sys::mrsh_command) {
+        if cmd.is_null() {
+            self.u8(NONE);
+            return;
+        }
+        self.u8((*cmd).type_ as u8);
+        match (*cmd).type_ {
+            sys::MRSH_SIMPLE_COMMAND => {
+                let sc = &*sys::mrsh_command_get_simple_command(cmd);
+                self.word(sc.name);
+                self.array(&sc.arguments, |w, word| w.word(word));
+                self.array(&sc.io_redirects, |w, redir| w.io_redirect(redir));
+                self.array(&sc.assignments, |w, assign| w.assignment(assign));
+            }
+            sys::MRSH_BRACE_GROUP => {
+                let bg = &*sys::mrsh_command_get_brace_group(cmd);
+                self.array(&bg.body, |w, l| w.command_list(l));
+                self.position(&bg.lbrace_pos);
+                self.position(&bg.rbrace_pos);
+            }
+            sys::MRSH_SUBSHELL => {
+                let s = &*sys::mrsh_command_get_subshell(cmd);
+                self.array(&s.body, |w, l| w.command_list(l));
+                self.position(&s.lparen_pos);
+                self.position(&s.rparen_pos);
+            }
+            sys::MRSH_IF_CLAUSE => {
+                let ic = &*sys::mrsh_command_get_if_clause(cmd);
+                self.array(&ic.condition, |w, l| w.command_list(l));
+                self.array(&ic.body, |w, l| w.command_list(l));
+                self.command(ic.else_part);
+                self.range(&ic.if_range);
+                self.range(&ic.then_range);
+                self.range(&ic.fi_range);
+                self.range(&ic.else_range);
+            }
+            sys::MRSH_FOR_CLAUSE => {
+                let fc = &*sys::mrsh_command_get_for_clause(cmd);
+                self.str(fc.name);
+                self.bool(fc.in_);
+                self.array(&fc.word_list, |w, word| w.word(word));
+                self.array(&fc.body, |w, l| w.command_list(l));
+                self.range(&fc.for_range);
+                self.range(&fc.name_range);
+                self.range(&fc.do_range);
+                self.range(&fc.done_range);
+                self.range(&fc.in_range);
+            }
+            sys::MRSH_LOOP_CLAUSE => {
+                let lc = &*sys::mrsh_command_get_loop_clause(cmd);
+                self.u8(lc.type_ as u8);
+                self.array(&lc.condition, |w, l| w.command_list(l));
+                self.array(&lc.body, |w, l| w.command_list(l));
+                self.range(&lc.while_until_range);
+                self.range(&lc.do_range);
+                self.range(&lc.done_range);
+            }
+            sys::MRSH_CASE_CLAUSE => {
+                let cc = &*sys::mrsh_command_get_case_clause(cmd);
+                self.word(cc.word);
+                self.array(&cc.items, |w, item| w.case_item(item));
+                self.range(&cc.case_range);
+                self.range(&cc.in_range);
+                self.range(&cc.esac_range);
+            }
+            sys::MRSH_FUNCTION_DEFINITION => {
+                let fd = &*sys::mrsh_command_get_function_definition(cmd);
+                self.str(fd.name);
+                self.command(fd.body);
+                self.array(&fd.io_redirects, |w, redir| w.io_redirect(redir));
+                self.range(&fd.name_range);
+                self.position(&fd.lparen_pos);
+                self.position(&fd.rparen_pos);
+            }
+            _ => unreachable!(),
+        }
+    }
+
+    unsafe fn case_item(&mut self, item: *const sys::mrsh_case_item) {
+        let item = &*item;
+        self.array(&item.patterns, |w, word| w.word(word));
+        self.array(&item.body, |w, l| w.command_list(l));
+        self.position(&item.lparen_pos);
+        self.position(&item.rparen_pos);
+        self.range(&item.dsemi_range);
+    }
+
+    unsafe fn io_redirect(&mut self, redir: *const sys::mrsh_io_redirect) {
+        let redir = &*redir;
+        self.int(redir.io_number as i64);
+        self.u8(redir.op as u8);
+        self.word(redir.name);
+        self.array(&redir.here_document, |w, word| w.word(word));
+        self.position(&redir.io_number_pos);
+        self.range(&redir.op_range);
+    }
+
+    unsafe fn assignment(&mut self, assign: *const sys::mrsh_assignment) {
+        let assign = &*assign;
+        self.str(assign.name);
+        self.word(assign.value);
+        self.range(&assign.name_range);
+        self.position(&assign.equal_pos);
+    }
+
+    unsafe fn word(&mut self, word: *const sys::mrsh_word) {
+        if word.is_null() {
+            self.u8(NONE);
+            return;
+        }
+        self.u8((*word).type_ as u8);
+        match (*word).type_ {
+            sys::MRSH_WORD_STRING => {
+                let ws = &*sys::mrsh_word_get_string(word);
+                self.str(ws.str);
+                self.bool(ws.single_quoted);
+                self.bool(ws.split_fields);
+                self.range(&ws.range);
+            }
+            sys::MRSH_WORD_PARAMETER => {
+                let wp = &*sys::mrsh_word_get_parameter(word);
+                self.str(wp.name);
+                self.u8(wp.op as u8);
+                self.bool(wp.colon);
+                self.word(wp.arg);
+                self.position(&wp.dollar_pos);
+                self.range(&wp.name_range);
+                self.range(&wp.op_range);
+                self.position(&wp.lbrace_pos);
+                self.position(&wp.rbrace_pos);
+            }
+            sys::MRSH_WORD_COMMAND => {
+                let wc = &*sys::mrsh_word_get_command(word);
+                if wc.program.is_null() {
+                    self.u8(NONE);
+                } else {
+                    self.u8(0);
+                    self.program(wc.program);
+                }
+                self.bool(wc.back_quoted);
+                self.range(&wc.range);
+            }
+            sys::MRSH_WORD_ARITHMETIC => {
+                let wa = &*sys::mrsh_word_get_arithmetic(word);
+                self.word(wa.body);
+            }
+            sys::MRSH_WORD_LIST => {
+                let wl = &*sys::mrsh_word_get_list(word);
+                self.array(&wl.children, |w, child| w.word(child));
+                self.bool(wl.double_quoted);
+                self.position(&wl.lquote_pos);
+                self.position(&wl.rquote_pos);
+            }
+            _ => unreachable!(),
+        }
+    }
+}
+
+/// A node under construction. It is destroyed if decoding fails before it is
+/// linked into its parent.
+struct Owned<T> {
+    ptr: *mut T,
+    destroy: unsafe extern "C" fn(*mut T),
+}
+
+impl<T> Owned<T> {
+    fn new(ptr: *mut T, destroy: unsafe extern "C" fn(*mut T)) -> Owned<T> {
+        assert!(!ptr.is_null(), "out of memory");
+        Owned { ptr, destroy }
+    }
+
+    fn into_raw(self) -> *mut T {
+        let ptr = self.ptr;
+        mem::forget(self);
+        ptr
+    }
+}
+
+impl<T> Drop for Owned<T> {
+    fn drop(&mut self) {
+        unsafe { (self.destroy)(self.ptr) }
+    }
+}
+
+fn into_raw_or_null<T>(v: Option<Owned<T>>) -> *mut T {
+    v.map_or(ptr::null_mut(), Owned::into_raw)
+}
+
+/// Move decoded nodes into a freshly allocated `mrsh_array`.
+unsafe fn into_array<T>(items: Vec<Owned<T>>) -> sys::mrsh_array {
+    let mut array = sys::mrsh_array {
+        data: ptr::null_mut(),
+        len: 0,
+        cap: 0,
+    };
+    if !items.is_empty() {
+        assert!(
+            sys::mrsh_array_reserve(&mut array, items.len()),
+            "out of memory"
+        );
+    }
+    for item in items {
+        sys::mrsh_array_add(&mut array, item.into_raw().cast());
+    }
+    array
+}
+
+unsafe extern "C" fn free_str(s: *mut c_char) {
+    libc::free(s.cast())
+}
+
+/// Counterpart of the case item cleanup in `mrsh_command_destroy`, for items
+/// that were decoded but not yet attached to their clause.
+unsafe extern "C" fn case_item_destroy(item: *mut sys::mrsh_case_item) {
+    for &word in array_slice::<sys::mrsh_word>(&(*item).patterns) {
+        sys::mrsh_word_destroy(word);
+    }
+    sys::mrsh_array_finish(&mut (*item).patterns);
+    for &l in array_slice::<sys::mrsh_command_list>(&(*item).body) {
+        sys::mrsh_command_list_destroy(l);
+    }
+    sys::mrsh_array_finish(&mut (*item).body);
+    libc::free(item.cast());
+}
+
+unsafe fn alloc_zeroed<T>() -> *mut T {
+    let ptr = libc::calloc(1, mem::size_of::<T>()) as *mut T;
+    assert!(!ptr.is_null(), "out of memory");
+    ptr
+}
+
+struct Reader<'a> {
+    data: &'a [u8],
+    pos: usize,
+}
+
+type Result<T> = std::result::Result<T, DecodeError>;
+
+impl<'a> Reader<'a> {
+    fn u8(&mut self) -> Result<u8> {
+        let v = *self.data.get(self.pos).ok_or(DecodeError::UnexpectedEof)?;
+        self.pos += 1;
+        Ok(v)
+    }
+
+    fn bool(&mut self) -> Result<bool> {
+        Ok(self.u8()? != 0)
+    }
+
+    fn uint(&mut self) -> Result<u64> {
+        let mut v = 0u64;
+        let mut shift = 0;
+        loop {
+            let byte = self.u8()?;
+            if shift < 64 {
+                v |= ((byte & 0x7f) as u64) << shift;
+            }
+            if byte & 0x80 == 0 {
+                return Ok(v);
+            }
+            shift += 7;
+        }
+    }
+
+    fn int(&mut self) -> Result<i64> {
+        let v = self.uint()?;
+        Ok((v >> 1) as i64 ^ -((v & 1) as i64))
+    }
+
+    fn c_int(&mut self) -> Result<c_int> {
+        Ok(self.int()? as c_int)
+    }
+
+    fn tag(&mut self) -> Result<c_uint> {
+        Ok(self.u8()? as c_uint)
+    }
+
+    fn len(&mut self) -> Result<usize> {
+        let len = self.uint()? as usize;
+        // Every element takes at least one byte
+        if len > self.data.len() - self.pos {
+            return Err(DecodeError::UnexpectedEof);
+        }
+        Ok(len)
+    }
+
+    fn str(&mut self) -> Result<Owned<c_char>> {
+        let len = self.len()?;
+        let bytes = &self.data[self.pos..self.pos + len];
+        if bytes.contains(&0) {
+            return Err(DecodeError::InvalidString);
+        }
+        self.pos += len;
+        unsafe {
+            let s = libc::malloc(len + 1) as *mut c_char;
+            assert!(!s.is_null(), "out of memory");
+            ptr::copy_nonoverlapping(bytes.as_ptr(), s as *mut u8, len);
+            *s.add(len) = 0;
+            Ok(Owned::new(s, free_str))
+        }
+    }
+
+    fn position(&mut self) -> Result<sys::mrsh_position> {
+        Ok(sys::mrsh_position {
+            offset: self.uint()? as usize,
+            line: self.c_int()?,
+            column: self.c_int()?,
+        })
+    }
+
+    fn range(&mut self) -> Result<sys::mrsh_range> {
+        Ok(sys::mrsh_range {
+            begin: self.position()?,
+            end: self.position()?,
+        })
+    }
+
+    fn array<T>(
+        &mut self,
+        mut f: impl FnMut(&mut Self) -> Result<Owned<T>>,
+    ) -> Result<Vec<Owned<T>>> {
+        let len = self.len()?;
+        let mut items = Vec::with_capacity(len);
+        for _ in 0..len {
+            items.push(f(self)?);
+        }
+        Ok(items)
+    }
+
+    unsafe fn program(&mut self) -> Result<Owned<sys::mrsh_program>> {
+        let body = self.array(|r| r.command_list())?;
+        let prog = Owned::new(sys::mrsh_program_create(), sys::mrsh_program_destroy);
+        (*prog.ptr).body = into_array(body);
+        Ok(prog)
+    }
+
+    unsafe fn command_list(&mut self) -> Result<Owned<sys::mrsh_command_list>> {
+        let and_or_list = self.and_or_list()?;
+        let ampersand = self.bool()?;
+        let separator_pos = self.position()?;
+        let l = Owned::new(
+            sys::mrsh_command_list_create(),
+            sys::mrsh_command_list_destroy,
+        );
+        (*l.ptr).and_or_list = and_or_list.into_raw();
+        (*l.ptr).ampersand = ampersand;
+        (*l.ptr).separator_pos = separator_pos;
+        Ok(l)
+    }
+
+    unsafe fn and_or_list(&mut self) -> Result<Owned<sys::mrsh_and_or_list>> {
+        let and_or_list = match self.tag()? {
+            sys::MRSH_AND_OR_LIST_PIPELINE => {
+                let commands = self.array(|r| r.command()?.ok_or(DecodeError::InvalidTag(NONE)))?;
+                let bang = self.bool()?;
+                let bang_pos = self.position()?;
+                let pl = sys::mrsh_pipeline_create(&mut into_array(commands), bang);
+                (*pl).bang_pos = bang_pos;
+                &mut (*pl).and_or_list as *mut _
+            }
+            sys::MRSH_AND_OR_LIST_BINOP => {
+                let type_ = self.tag()?;
+                if type_ > sys::MRSH_BINOP_OR {
+                    return Err(DecodeError::InvalidTag(type_ as u8));
+                }
+                let left = self.and_or_list()?;
+                let right = self.and_or_list()?;
+                let op_range = self.range()?;
+                let binop = sys::mrsh_binop_create(type_, left.into_raw(), right.into_raw());
+                (*binop).op_range = op_range;
+                &mut (*binop).and_or_list as *mut _
+            }
+            tag => return Err(DecodeError::InvalidTag(tag as u8)),
+        };
+        Ok(Owned::new(and_or_list, sys::mrsh_and_or_list_destroy))
+    }
+
+    unsafe fn command(&mut self) -> Result<Option<Owned<sys::mrsh_command>>> {
+        let cmd = match self.tag()? {
+            tag if tag == NONE as c_uint => return Ok(None),
+            sys::MRSH_SIMPLE_COMMAND => {
+                let name = self.word()?;
+                let arguments = self.array(|r| r.required_word())?;
+                let io_redirects = self.array(|r| r.io_redirect())?;
+                let assignments = self.array(|r| r.assignment())?;
+                let sc = sys::mrsh_simple_command_create(
+                    into_raw_or_null(name),
+                    &mut into_array(arguments),
+                    &mut into_array(io_redirects),
+                    &mut into_array(assignments),
+                );
+                &mut (*sc).command as *mut _
+            }
+            sys::MRSH_BRACE_GROUP => {
+                let body = self.array(|r| r.command_list())?;
+                let lbrace_pos = self.position()?;
+                let rbrace_pos = self.position()?;
+                let bg = sys::mrsh_brace_group_create(&mut into_array(body));
+                (*bg).lbrace_pos = lbrace_pos;
+                (*bg).rbrace_pos = rbrace_pos;
+                &mut (*bg).command as *mut _
+            }
+            sys::MRSH_SUBSHELL => {
+                let body = self.array(|r| r.command_list())?;
+                let lparen_pos = self.position()?;
+                let rparen_pos = self.position()?;
+                let s = sys::mrsh_subshell_create(&mut into_array(body));
+                (*s).lparen_pos = lparen_pos;
+                (*s).rparen_pos = rparen_pos;
+                &mut (*s).command as *mut _
+            }
+            sys::MRSH_IF_CLAUSE => {
+                let condition = self.array(|r| r.command_list())?;
+                let body = self.array(|r| r.command_list())?;
+                let else_part = self.command()?;
+                let if_range = self.range()?;
+                let then_range = self.range()?;
+                let fi_range = self.range()?;
+                let else_range = self.range()?;
+                let ic = sys::mrsh_if_clause_create(
+                    &mut into_array(condition),
+                    &mut into_array(body),
+                    into_raw_or_null(else_part),
+                );
+                (*ic).if_range = if_range;
+                (*ic).then_range = then_range;
+                (*ic).fi_range = fi_range;
+                (*ic).else_range = else_range;
+                &mut (*ic).command as *mut _
+            }
+            sys::MRSH_FOR_CLAUSE => {
+                let name = self.str()?;
+                let in_ = self.bool()?;
+                let word_list = self.array(|r| r.required_word())?;
+                let body = self.array(|r| r.command_list())?;
+                let for_range = self.range()?;
+                let name_range = self.range()?;
+                let do_range = self.range()?;
+                let done_range = self.range()?;
+                let in_range = self.range()?;
+                let fc = sys::mrsh_for_clause_create(
+                    name.into_raw(),
+                    in_,
+                    &mut into_array(word_list),
+                    &mut into_array(body),
+                );
+                (*fc).for_range = for_range;
+                (*fc).name_range = name_range;
+                (*fc).do_range = do_range;
+                (*fc).done_range = done_range;
+                (*fc).in_range = in_range;
+                &mut (*fc).command as *mut _
+            }
+            sys::MRSH_LOOP_CLAUSE => {
+                let type_ = self.tag()?;
+                if type_ > sys::MRSH_LOOP_UNTIL {
+                    return Err(DecodeError::InvalidTag(type_ as u8));
+                }
+                let condition = self.array(|r| r.command_list())?;
+                let body = self.array(|r| r.command_list())?;
+                let while_until_range = self.range()?;
+                let do_range = self.range()?;
+                let done_range = self.range()?;
+                let lc = sys::mrsh_loop_clause_create(
+                    type_,
+                    &mut into_array(condition),
+                    &mut into_array(body),
+                );
+                (*lc).while_until_range = while_until_range;
+                (*lc).do_range = do_range;
+                (*lc).done_range = done_range;
+                &mut (*lc).command as *mut _
+            }
+            sys::MRSH_CASE_CLAUSE => {
+                let word = self.required_word()?;
+                let items = self.array(|r| r.case_item())?;
+                let case_range = self.range()?;
+                let in_range = self.range()?;
+                let esac_range = self.range()?;
+                let cc = sys::mrsh_case_clause_create(word.into_raw(), &mut into_array(items));
+                (*cc).case_range = case_range;
+                (*cc).in_range = in_range;
+                (*cc).esac_range = esac_range;
+                &mut (*cc).command as *mut _
+            }
+            sys::MRSH_FUNCTION_DEFINITION => {
+                let name = self.str()?;
+                let body = self.command()?.ok_or(DecodeError::InvalidTag(NONE))?;
+                let io_redirects = self.array(|r| r.io_redirect())?;
+                let name_range = self.range()?;
+                let lparen_pos = self.position()?;
+                let rparen_pos = self.position()?;
+                let fd = sys::mrsh_function_definition_create(
+                    name.into_raw(),
+                    body.into_raw(),
+                    &mut into_array(io_redirects),
+                );
+                (*fd).name_range = name_range;
+                (*fd).lparen_pos = lparen_pos;
+                (*fd).rparen_pos = rparen_pos;
+                &mut (*fd).command as *mut _
+            }
+            tag => return Err(DecodeError::InvalidTag(tag as u8)),
+        };
+        Ok(Some(Owned::new(cmd, sys::mrsh_command_destroy)))
+    }
+
+    unsafe fn case_item(&mut self) -> Result<Owned<sys::mrsh_case_item>> {
+        let patterns = self.array(|r| r.required_word())?;
+        let body = self.array(|r| r.command_list())?;
+        let lparen_pos = self.position()?;
+        let rparen_pos = self.position()?;
+        let dsemi_range = self.range()?;
+        let item = alloc_zeroed::<sys::mrsh_case_item>();
+        (*item).patterns = into_array(patterns);
+        (*item).body = into_array(body);
+        (*item).lparen_pos = lparen_pos;
+        (*item).rparen_pos = rparen_pos;
+        (*item).dsemi_range = dsemi_range;
+        Ok(Owned::new(item, case_item_destroy))
+    }
+
+    unsafe fn io_redirect(&mut self) -> Result<Owned<sys::mrsh_io_redirect>> {
+        let io_number = self.c_int()?;
+        let op = self.tag()?;
+        if op > sys::MRSH_IO_DLESSDASH {
+            return Err(DecodeError::InvalidTag(op as u8));
+        }
+        let name = self.required_word()?;
+        let here_document = self.array(|r| r.required_word())?;
+        let io_number_pos = self.position()?;
+        let op_range = self.range()?;
+        let redir = alloc_zeroed::<sys::mrsh_io_redirect>();
+        (*redir).io_number = io_number;
+        (*redir).op = op;
+        (*redir).name = name.into_raw();
+        (*redir).here_document = into_array(here_document);
+        (*redir).io_number_pos = io_number_pos;
+        (*redir).op_range = op_range;
+        Ok(Owned::new(redir, sys::mrsh_io_redirect_destroy))
+    }
+
+    unsafe fn assignment(&mut self) -> Result<Owned<sys::mrsh_assignment>> {
+        let name = self.str()?;
+        let value = self.required_word()?;
+        let name_range = self.range()?;
+        let equal_pos = self.position()?;
+        let assign = alloc_zeroed::<sys::mrsh_assignment>();
+        (*assign).name = name.into_raw();
+        (*assign).value = value.into_raw();
+        (*assign).name_range = name_range;
+        (*assign).equal_pos = equal_pos;
+        Ok(Owned::new(assign, sys::mrsh_assignment_destroy))
+    }
+
+    unsafe fn required_word(&mut self) -> Result<Owned<sys::mrsh_word>> {
+        self.word()?.ok_or(DecodeError::InvalidTag(NONE))
+    }
+
+    unsafe fn word(&mut self) -> Result<Option<Owned<sys::mrsh_word>>> {
+        let word = match self.tag()? {
+            tag if tag == NONE as c_uint => return Ok(None),
+            sys::MRSH_WORD_STRING => {
+                let s = self.str()?;
+                let single_quoted = self.bool()?;
+                let split_fields = self.bool()?;
+                let range = self.range()?;
+                let ws = sys::mrsh_word_string_create(s.into_raw(), single_quoted);
+                (*ws).split_fields = split_fields;
+                (*ws).range = range;
+                &mut (*ws).word as *mut _
+            }
+            sys::MRSH_WORD_PARAMETER => {
+                let name = self.str()?;
+                let op = self.tag()?;
+                if op > sys::MRSH_PARAM_DHASH {
+                    return Err(DecodeError::InvalidTag(op as u8));
+                }
+                let colon = self.bool()?;
+                let arg = self.word()?;
+                let dollar_pos = self.position()?;
+                let name_range = self.range()?;
+                let op_range = self.range()?;
+                let lbrace_pos = self.position()?;
+                let rbrace_pos = self.position()?;
+                let wp = sys::mrsh_word_parameter_create(
+                    name.into_raw(),
+                    op,
+                    colon,
+                    into_raw_or_null(arg),
+                );
+                (*wp).dollar_pos = dollar_pos;
+                (*wp).name_range = name_range;
+                (*wp).op_range = op_range;
+                (*wp).lbrace_pos = lbrace_pos;
+                (*wp).rbrace_pos = rbrace_pos;
+                &mut (*wp).word as *mut _
+            }
+            sys::MRSH_WORD_COMMAND => {
+                let prog = match self.u8()? {
+                    NONE => None,
+                    0 => Some(self.program()?),
+                    tag => return Err(DecodeError::InvalidTag(tag)),
+                };
+                let back_quoted = self.bool()?;
+                let range = self.range()?;
+                let wc = sys::mrsh_word_command_create(into_raw_or_null(prog), back_quoted);
+                (*wc).range = range;
+                &mut (*wc).word as *mut _
+            }
+            sys::MRSH_WORD_ARITHMETIC => {
+                let body = self.required_word()?;
+                let wa = sys::mrsh_word_arithmetic_create(body.into_raw());
+                &mut (*wa).word as *mut _
+            }
+            sys::MRSH_WORD_LIST => {
+                let children = self.array(|r| r.required_word())?;
+                let double_quoted = self.bool()?;
+                let lquote_pos = self.position()?;
+                let rquote_pos = self.position()?;
+                let wl = sys::mrsh_word_list_create(&mut into_array(children), double_quoted);
+                (*wl).lquote_pos = lquote_pos;
+                (*wl).rquote_pos = rquote_pos;
+                &mut (*wl).word as *mut _
+            }
+            tag => return Err(DecodeError::InvalidTag(tag as u8)),
+        };
+        Ok(Some(Owned::new(word, sys::mrsh_word_destroy)))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Decoding must give back the same tree, positions included, so encoding
+    /// the decoded program has to give the same bytes.
+    fn round_trip(src: &str) {
+        let prog = Program::parse(src.as_bytes()).unwrap();
+        let data = serialize(&prog);
+        let decoded = deserialize(&data).unwrap();
+        assert_eq!(serialize(&decoded), data, "{:?}", src);
+        assert_eq!(decoded.body().len(), prog.body().len());
+    }
+
+    #[test]
+    fn empty() {
+        round_trip("");
+    }
+
+    #[test]
+    fn simple_commands() {
+        round_trip("FOO=bar echo \"$HOME\" 'x y' >out 2>&1 && ! false || true &\n");
+    }
+
+    #[test]
+    fn here_documents() {
+        round_trip("cat <<EOF; cat <<-'END'\nline $x\nEOF\n\tquoted $y\nEND\necho done\n");
+    }
+
+    #[test]
+    fn nested_lists() {
+        round_trip(
+            "if a; then { b; c | d; }; elif e; then (f && g); else h; fi\n\
+             while x; do for i in 1 2 3; do until y; do :; done; done; done\n",
+        );
+    }
+
+    #[test]
+    fn case_clauses() {
+        round_trip("case $1 in\n(a|b) x ;;\n*.c) y; z ;;\n*) ;;\nesac\n");
+    }
+
+    #[test]
+    fn functions() {
+        round_trip("f() { echo $(( $1 + 1 )) `g` ${2:-def} \"${#3}\"; } >log\nf 1\n");
+    }
+
+    #[test]
+    fn truncated_input() {
+        let prog = Program::parse(b"echo a; echo b").unwrap();
+        let data = serialize(&prog);
+        for len in 0..data.len() {
+            assert!(deserialize(&data[..len]).is_err());
+        }
+    }
+}
@@ -0,0 +1,505 @@
+//! Running programs in a child process, for use from async code.
+//!
+//! libmrsh's executor blocks until every foreground job has finished, so a
+//! program is run in a forked copy of the shell instead. The parent keeps a
+//! file descriptor that becomes readable when the child exits: a pidfd where
+//! the kernel supports it, or else a pipe. `Running::wait_async` waits on it
+//! through a single reactor thread shared by all running programs.
+
+use std::cell::Cell;
+use std::collections::HashMap;
+use std::future::Future;
+use std::io;
+use std::os::raw::c_int;
+use std::os::unix::io::{AsRawFd, FromRawFd, OwnedFd, RawFd};
+use std::pin::Pin;
+use std::ptr;
+use std::sync::atomic::{AtomicI32, Ordering};
+use std::sync::{Mutex, Once, OnceLock};
+use std::task::{Context, Poll, Waker};
+use std::thread;
+
+use crate::parser::Program;
+use crate::state::State;
+
+/// A program running in a child process.
+///
+/// As with `std::process::Child`, dropping a `Running` neither kills nor
+/// waits for the child.
+pub struct Running {
+    pid: libc::pid_t,
+    fd: OwnedFd,
+    status: Option<c_int>,
+    registered: bool,
+}
+
+impl State {
+    /// Run a program in a forked copy of the shell, as if in a subshell:
+    /// changes it makes to the state are not seen by this one.
+    ///
+    /// Only the calling thread exists in the child. The child runs the shell
+    /// and allocates memory, which is fine with glibc's fork-safe malloc, but
+    /// it must not need locks other threads of this process may be holding.
+    pub fn spawn_program(&mut self, prog: &Program) -> io::Result<Running> {
+        self.spawn(prog, has_pidfd())
+    }
+
+    fn spawn(&mut self, prog: &Program, pidfd: bool) -> io::Result<Running> {
+        let mut pipe = [-1; 2];
+        // Held until the parent has closed the write end of the pipe; see
+        // `IN_FLIGHT`
+        let _guard = if pidfd {
+            None
+        } else {
+            static ATFORK: Once = Once::new();
+            ATFORK.call_once(|| unsafe {
+                libc::pthread_atfork(None, None, Some(close_pipe_write_ends));
+            });
+            let guard = SPAWN_LOCK.lock().unwrap();
+            if unsafe { libc::pipe2(pipe.as_mut_ptr(), libc::O_CLOEXEC) } != 0 {
+                return Err(io::Error::last_os_error());
+            }
+            IN_FLIGHT.store(pipe[1], Ordering::Relaxed);
+            Some(guard)
+        };
+
+        SPAWNING.with(|spawning| spawning.set(!pidfd));
+        let pid = unsafe { libc::fork() };
+        SPAWNING.with(|spawning| spawning.set(false));
+        if pid < 0 {
+            let err = io::Error::last_os_error();
+            if pipe[0] >= 0 {
+                IN_FLIGHT.store(-1, Ordering::Relaxed);
+                unsafe {
+                    libc::close(pipe[0]);
+                    libc::close(pipe[1]);
+                }
+            }
+            return Err(err);
+        }
+        if pid == 0 {
+            // The write end of the pipe stays open until the child exits.
+            // It is close-on-exec, and subshells the child forks close it,
+            // so nothing else holds it.
+            if pipe[0] >= 0 {
+                unsafe { libc::close(pipe[0]) };
+                IN_FLIGHT.store(-1, Ordering::Relaxed);
+                PIPE_WRITE_END.store(pipe[1], Ordering::Relaxed);
+            }
+            let status = self.run_program(prog);
+            let exit = self.exit_status();
+            unsafe {
+                libc::fflush(ptr::null_mut());
+                libc::_exit(if exit >= 0 { exit } else { status });
+            }
+        }
+
+        let fd = if pipe[0] >= 0 {
+            IN_FLIGHT.store(-1, Ordering::Relaxed);
+            unsafe { libc::close(pipe[1]) };
+            pipe[0]
+        } else {
+            let fd = unsafe { libc::syscall(libc::SYS_pidfd_open, pid, 0) } as RawFd;
+            if fd < 0 {
+                // The child has not been reaped, so this can't fail because
+                // it exited
+                let err = io::Error::last_os_error();
+                unsafe { libc::kill(pid, libc::SIGKILL) };
+                let _ = wait_pid(pid, 0);
+                return Err(err);
+            }
+            fd
+        };
+        Ok(Running {
+            pid,
+            fd: unsafe { OwnedFd::from_raw_fd(fd) },
+            status: None,
+            registered: false,
+        })
+    }
+}
+
+impl Running {
+    pub fn pid(&self) -> libc::pid_t {
+        self.pid
+    }
+
+    /// The exit status if the program has finished. A child killed by a
+    /// signal gets 128 plus the signal number, as in `$?`.
+    pub fn try_wait(&mut self) -> io::Result<Option<c_int>> {
+        if self.status.is_none() {
+            self.status = wait_pid(self.pid, libc::WNOHANG)?;
+        }
+        Ok(self.status)
+    }
+
+    /// Block until the program has finished.
+    pub fn wait(&mut self) -> io::Result<c_int> {
+        if self.status.is_none() {
+            self.status = wait_pid(self.pid, 0)?;
+        }
+        Ok(self.status.unwrap())
+    }
+
+    /// Wait for the program to finish without blocking the calling thread.
+    pub fn wait_async(&mut self) -> Wait<'_> {
+        Wait { running: self }
+    }
+}
+
+impl AsRawFd for Running {
+    /// A descriptor that becomes readable when the program has finished.
+    fn as_raw_fd(&self) -> RawFd {
+        self.fd.as_raw_fd()
+    }
+}
+
+impl Drop for Running {
+    fn drop(&mut self) {
+        if self.registered {
+            if let Ok(reactor) = reactor() {
+                reactor.deregister(self.fd.as_raw_fd());
+            }
+        }
+    }
+}
+
+/// The future returned by `Running::wait_async`.
+pub struct Wait<'a> {
+    running: &'a mut Running,
+}
+
+impl Future for Wait<'_> {
+    type Output = io::Result<c_int>;
+
+    fn poll(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<io::Result<c_int>> {
+        let running = &mut *self.get_mut().running;
+        match running.try_wait() {
+            Ok(Some(status)) => return Poll::Ready(Ok(status)),
+            Ok(None) => {}
+            Err(err) => return Poll::Ready(Err(err)),
+        }
+        // The descriptor is watched level-triggered, so an exit between
+        // try_wait and here still wakes us up
+        let registered = reactor()
+            .and_then(|reactor| reactor.register(running.fd.as_raw_fd(), cx.waker().clone()));
+        if let Err(err) = registered {
+            return Poll::Ready(Err(err));
+        }
+        running.registered = true;
+        Poll::Pending
+    }
+}
+
+/// The write end of the exit pipe, in a child running a program.
+static PIPE_WRITE_END: AtomicI32 = AtomicI32::new(-1);
+
+/// The write end of the exit pipe, in the parent while it is being spawned.
+/// A fork by another thread in the meantime would hold it open, and delay
+/// the end of the wait until that process exits, so children close it.
+/// This covers fork() but not raw clone(); posix_spawn and vfork children
+/// only hold it until they exec.
+static IN_FLIGHT: AtomicI32 = AtomicI32::new(-1);
+
+/// Serializes spawns in the pipe fallback, which share `IN_FLIGHT`.
+static SPAWN_LOCK: Mutex<()> = Mutex::new(());
+
+thread_local! {
+    /// Set while this thread forks a child that keeps `IN_FLIGHT` open.
+    static SPAWNING: Cell<bool> = const { Cell::new(false) };
+}
+
+extern "C" fn close_pipe_write_ends() {
+    if !SPAWNING.with(Cell::get) {
+        let fd = IN_FLIGHT.swap(-1, Ordering::Relaxed);
+        if fd >= 0 {
+            unsafe { libc::close(fd) };
+        }
+    }
+    let fd = PIPE_WRITE_END.swap(-1, Ordering::Relaxed);
+    if fd >= 0 {
+        unsafe { libc::close(fd) };
+    }
+}
+
+fn wait_pid(pid: libc::pid_t, options: c_int) -> io::Result<Option<c_int>> {
+    let mut stat = 0;
+    loop {
+        let ret = unsafe { libc::waitpid(pid, &mut stat, options) };
+        if ret > 0 {
+            break;
+        } else if ret == 0 {
+            return Ok(None);
+        }
+        let err = io::Error::last_os_error();
+        if err.kind() != io::ErrorKind::Interrupted {
+            return Err(err);
+        }
+    }
+    if libc::WIFSIGNALED(stat) {
+        Ok(Some(128 + libc::WTERMSIG(stat)))
+    } else {
+        Ok(Some(libc::WEXITSTATUS(stat)))
+    }
+}
+
+fn has_pidfd() -> bool {
+    static HAS_PIDFD: OnceLock<bool> = OnceLock::new();
+    *HAS_PIDFD.get_or_init(|| {
+        let fd = unsafe { libc::syscall(libc::SYS_pidfd_open, libc::getpid(), 0) };
+        if fd < 0 {
+            return false;
+        }
+        unsafe { libc::close(fd as RawFd) };
+        true
+    })
+}
+
+/// An epoll thread that wakes the tasks waiting on running programs.
+struct Reactor {
+    epoll: OwnedFd,
+    waiters: Mutex<Waiters>,
+}
+
+struct Waiters {
+    /// Descriptors in the epoll set, and the task to wake when one becomes
+    /// readable. Events are one-shot, so a woken task has to register again.
+    wakers: HashMap<RawFd, Option<Waker>>,
+    /// Set when epoll_wait has failed and the thread has stopped.
+    error: Option<i32>,
+}
+
+/// The shared reactor, started on first use. Failing to start it is not
+/// retried.
+fn reactor() -> io::Result<&'static Reactor> {
+    static REACTOR: OnceLock<Result<Reactor, i32>> = OnceLock::new();
+    let reactor = REACTOR.get_or_init(|| {
+        let epoll = unsafe { libc::epoll_create1(libc::EPOLL_CLOEXEC) };
+        if epoll < 0 {
+            return Err(errno(&io::Error::last_os_error()));
+        }
+        let epoll = unsafe { OwnedFd::from_raw_fd(epoll) };
+        // The thread waits for the initialization to finish
+        thread::Builder::new()
+            .name("mrsh-reactor".to_owned())
+            .spawn(|| {
+                if let Ok(reactor) = reactor() {
+                    reactor.run();
+                }
+            })
+            .map_err(|err| errno(&err))?;
+        Ok(Reactor {
+            epoll,
+            waiters: Mutex::new(Waiters {
+                wakers: HashMap::new(),
+                error: None,
+            }),
+        })
+    });
+    reactor
+        .as_ref()
+        .map_err(|&errno| io::Error::from_raw_os_error(errno))
+}
+
+fn errno(err: &io::Error) -> i32 {
+    err.raw_os_error().unwrap_or(libc::EIO)
+}
+
+impl Reactor {
+    fn register(&self, fd: RawFd, waker: Waker) -> io::Result<()> {
+        let mut waiters = self.waiters.lock().unwrap();
+        if let Some(errno) = waiters.error {
+            return Err(io::Error::from_raw_os_error(errno));
+        }
+        let op = if waiters.wakers.contains_key(&fd) {
+            libc::EPOLL_CTL_MOD
+        } else {
+            libc::EPOLL_CTL_ADD
+        };
+        let mut event = libc::epoll_event {
+            events: (libc::EPOLLIN | libc::EPOLLONESHOT) as u32,
+            u64: fd as u64,
+        };
+        if unsafe { libc::epoll_ctl(self.epoll.as_raw_fd(), op, fd, &mut event) } != 0 {
+            return Err(io::Error::last_os_error());
+        }
+        waiters.wakers.insert(fd, Some(waker));
+        Ok(())
+    }
+
+    /// Must be called before the descriptor is closed.
+    fn deregister(&self, fd: RawFd) {
+        let mut waiters = self.waiters.lock().unwrap();
+        if waiters.wakers.remove(&fd).is_some() {
+            unsafe {
+                libc::epoll_ctl(
+                    self.epoll.as_raw_fd(),
+                    libc::EPOLL_CTL_DEL,
+                    fd,
+                    ptr::null_mut(),
+                )
+            };
+        }
+    }
+
+    fn run(&self) {
+        let mut events = [libc::epoll_event { events: 0, u64: 0 }; 64];
+        loop {
+            let n = unsafe {
+                libc::epoll_wait(
+                    self.epoll.as_raw_fd(),
+                    events.as_mut_ptr(),
+                    events.len() as c_int,
+                    -1,
+                )
+            };
+            if n < 0 {
+                let err = io::Error::last_os_error();
+                if err.kind() == io::ErrorKind::Interrupted {
+                    continue;
+                }
+                // Wake everyone up; their next registration fails with the
+                // error
+                let ready = {
+                    let mut waiters = self.waiters.lock().unwrap();
+                    waiters.error = Some(errno(&err));
+                    waiters
+                        .wakers
+                        .values_mut()
+                        .filter_map(Option::take)
+                        .collect::<Vec<_>>()
+                };
+                ready.into_iter().for_each(Waker::wake);
+                return;
+            }
+            let ready = {
+                let mut waiters = self.waiters.lock().unwrap();
+                events[..n as usize]
+                    .iter()
+                    .filter_map(|event| waiters.wakers.get_mut(&(event.u64 as RawFd))?.take())
+                    .collect::<Vec<_>>()
+            };
+            ready.into_iter().for_each(Waker::wake);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::sync::Arc;
+    use std::task::Wake;
+    use std::thread::Thread;
+    use std::time::Duration;
+
+    /// Where pidfds are supported, test the pipe fallback as well.
+    fn modes() -> Vec<bool> {
+        if has_pidfd() {
+            vec![true, false]
+        } else {
+            vec![false]
+        }
+    }
+
+    fn spawn(src: &str, pidfd: bool) -> Running {
+        let prog = Program::parse(src.as_bytes()).unwrap();
+        State::new().spawn(&prog, pidfd).unwrap()
+    }
+
+    struct Unpark(Thread);
+
+    impl Wake for Unpark {
+        fn wake(self: Arc<Self>) {
+            self.0.unpark();
+        }
+    }
+
+    fn block_on<F: Future>(fut: F) -> F::Output {
+        let mut fut = Box::pin(fut);
+        let waker = Waker::from(Arc::new(Unpark(thread::current())));
+        let mut cx = Context::from_waker(&waker);
+        loop {
+            if let Poll::Ready(out) = fut.as_mut().poll(&mut cx) {
+                return out;
+            }
+            thread::park();
+        }
+    }
+
+    #[test]
+    fn exit_status() {
+        for pidfd in modes() {
+            assert_eq!(spawn("true", pidfd).wait().unwrap(), 0);
+            assert_eq!(spawn("false", pidfd).wait().unwrap(), 1);
+            assert_eq!(spawn("exit 3; exit 4", pidfd).wait().unwrap(), 3);
+            assert_eq!(spawn("(exit 5)", pidfd).wait().unwrap(), 5);
+        }
+    }
+
+    #[test]
+    fn killed_by_signal() {
+        for pidfd in modes() {
+            let mut running = spawn("while :; do :; done", pidfd);
+            assert_eq!(running.try_wait().unwrap(), None);
+            unsafe { libc::kill(running.pid(), libc::SIGKILL) };
+            assert_eq!(running.wait().unwrap(), 128 + libc::SIGKILL);
+            // The status is kept once the child has been reaped
+            assert_eq!(running.try_wait().unwrap(), Some(128 + libc::SIGKILL));
+        }
+    }
+
+    #[test]
+    fn try_wait() {
+        for pidfd in modes() {
+            let mut running = spawn("exit 7", pidfd);
+            let status = loop {
+                if let Some(status) = running.try_wait().unwrap() {
+                    break status;
+                }
+                thread::sleep(Duration::from_millis(1));
+            };
+            assert_eq!(status, 7);
+            assert_eq!(running.wait().unwrap(), 7);
+        }
+    }
+
+    #[test]
+    fn wait_async() {
+        for pidfd in modes() {
+            // Still running when first polled
+            let mut running = spawn(
+                "i=0; while case $i in 1000) false;; *) true;; esac; do i=$((i + 1)); done; exit 9",
+                pidfd,
+            );
+            assert_eq!(block_on(running.wait_async()).unwrap(), 9);
+            // Several at once share the reactor
+            let mut all = (0..8)
+                .map(|i| spawn(&format!("exit {}", i), pidfd))
+                .collect::<Vec<_>>();
+            let statuses = all
+                .iter_mut()
+                .map(|running| block_on(running.wait_async()).unwrap())
+                .collect::<Vec<_>>();
+            assert_eq!(statuses, (0..8).collect::<Vec<_>>());
+        }
+    }
+
+    #[test]
+    fn pipe_closed_in_other_forks() {
+        // A process forked while the exit pipe is open must not keep the
+        // wait from ending
+        let other = thread::spawn(|| {
+            (0..50)
+                .map(|_| spawn("while :; do :; done", has_pidfd()))
+                .collect::<Vec<_>>()
+        });
+        for _ in 0..50 {
+            let mut running = spawn("true", false);
+            assert_eq!(block_on(running.wait_async()).unwrap(), 0);
+        }
+        for mut running in other.join().unwrap() {
+            unsafe { libc::kill(running.pid(), libc::SIGKILL) };
+            running.wait().unwrap();
+        }
+    }
+}
@@ -0,0 +1,72 @@
+use std::ffi::{CStr, CString};
+use std::os::raw::c_int;
+use std::ptr::{self, NonNull};
+
+use crate::parser::Program;
+use crate::sys;
+
+/// A shell state. Wraps `struct mrsh_state`.
+pub struct State {
+    raw: NonNull<sys::mrsh_state>,
+}
+
+impl State {
+    pub fn new() -> State {
+        let raw = unsafe { sys::mrsh_state_create() };
+        State {
+            raw: NonNull::new(raw).expect("mrsh_state_create failed"),
+        }
+    }
+
+    pub fn as_ptr(&self) -> *mut sys::mrsh_state {
+        self.raw.as_ptr()
+    }
+
+    /// Get a variable's value.
+    pub fn env_get(&self, key: &str) -> Option<String> {
+        let key = CString::new(key).expect("variable name contains a NUL byte");
+        let value = unsafe { sys::mrsh_env_get(self.as_ptr(), key.as_ptr(), ptr::null_mut()) };
+        if value.is_null() {
+            return None;
+        }
+        Some(
+            unsafe { CStr::from_ptr(value) }
+                .to_string_lossy()
+                .into_owned(),
+        )
+    }
+
+    /// Set a variable. `attribs` is a set of `MRSH_VAR_ATTRIB_*` flags.
+    pub fn env_set(&mut self, key: &str, value: &str, attribs: u32) {
+        let key = CString::new(key).expect("variable name contains a NUL byte");
+        let value = CString::new(value).expect("variable value contains a NUL byte");
+        unsafe { sys::mrsh_env_set(self.as_ptr(), key.as_ptr(), value.as_ptr(), attribs) }
+    }
+
+    pub fn env_unset(&mut self, key: &str) {
+        let key = CString::new(key).expect("variable name contains a NUL byte");
+        unsafe { sys::mrsh_env_unset(self.as_ptr(), key.as_ptr()) }
+    }
+
+    /// Run a program and return its exit status.
+    pub fn run_program(&mut self, prog: &Program) -> c_int {
+        unsafe { sys::mrsh_run_program(self.as_ptr(), prog.as_ptr()) }
+    }
+
+    /// The status set by `exit`, or -1 if the shell should keep running.
+    pub fn exit_status(&self) -> c_int {
+        unsafe { (*self.as_ptr()).exit }
+    }
+}
+
+impl Default for State {
+    fn default() -> State {
+        State::new()
+    }
+}
+
+impl Drop for State {
+    fn drop(&mut self) {
+        unsafe { sys::mrsh_state_destroy(self.as_ptr()) }
+    }
+}
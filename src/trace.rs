@@ -0,0 +1,331 @@
+//! Per-command timing of top-level command lists.
+//!
+//! `State::run_program_traced` runs a program one top-level command list at a
+//! time and reports the source range, exit status, wall time and CPU time of
+//! each. `Profile` aggregates these into the folded-stack format read by
+//! flame graph tools. Plain `State::run_program` is not affected.
+
+use std::collections::BTreeMap;
+use std::ffi::CStr;
+use std::io::{self, Write};
+use std::mem;
+use std::os::raw::c_int;
+use std::time::{Duration, Instant};
+
+use crate::parser::{array_slice, Program};
+use crate::state::State;
+use crate::sys;
+
+/// CPU time used by the shell and by the children it reaped.
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct CpuTime {
+    pub user: Duration,
+    pub system: Duration,
+    pub children_user: Duration,
+    pub children_system: Duration,
+}
+
+impl CpuTime {
+    fn now() -> CpuTime {
+        let (user, system) = rusage(libc::RUSAGE_SELF);
+        let (children_user, children_system) = rusage(libc::RUSAGE_CHILDREN);
+        CpuTime {
+            user,
+            system,
+            children_user,
+            children_system,
+        }
+    }
+
+    fn since(&self, earlier: &CpuTime) -> CpuTime {
+        CpuTime {
+            user: self.user - earlier.user,
+            system: self.system - earlier.system,
+            children_user: self.children_user - earlier.children_user,
+            children_system: self.children_system - earlier.children_system,
+        }
+    }
+}
+
+fn rusage(who: c_int) -> (Duration, Duration) {
+    let mut usage: libc::rusage = unsafe { mem::zeroed() };
+    unsafe { libc::getrusage(who, &mut usage) };
+    let duration = |tv: libc::timeval| Duration::new(tv.tv_sec as u64, tv.tv_usec as u32 * 1000);
+    (duration(usage.ru_utime), duration(usage.ru_stime))
+}
+
+/// The outcome of one top-level command list.
+#[derive(Debug, Clone)]
+pub struct Trace {
+    pub begin: sys::mrsh_position,
+    pub end: sys::mrsh_position,
+    /// A short description, e.g. `upload "$host" && activate "$host"`
+    /// shortened to `upload && activate`.
+    pub label: String,
+    pub status: c_int,
+    pub wall: Duration,
+    pub cpu: CpuTime,
+}
+
+impl State {
+    /// Like `run_program`, but calls `f` after each top-level command list.
+    /// Stops early if the program exits.
+    pub fn run_program_traced<F: FnMut(&Trace)>(&mut self, prog: &Program, mut f: F) -> c_int {
+        let mut status = 0;
+        for &l in prog.body() {
+            let mut body = l;
+            // A borrowed single-list program; nothing in it is freed
+            let mut single = sys::mrsh_program {
+                node: sys::mrsh_node {
+                    type_: sys::MRSH_NODE_PROGRAM,
+                },
+                body: sys::mrsh_array {
+                    data: &mut body as *mut _ as *mut _,
+                    len: 1,
+                    cap: 1,
+                },
+            };
+
+            let cpu = CpuTime::now();
+            let start = Instant::now();
+            status = unsafe { sys::mrsh_run_program(self.as_ptr(), &mut single) };
+            let wall = start.elapsed();
+            let cpu = CpuTime::now().since(&cpu);
+
+            let (begin, end) = unsafe { command_list_range(l) };
+            f(&Trace {
+                begin,
+                end,
+                label: unsafe { and_or_list_label((*l).and_or_list) },
+                status,
+                wall,
+                cpu,
+            });
+
+            if self.exit_status() >= 0 {
+                break;
+            }
+        }
+        status
+    }
+}
+
+unsafe fn command_list_range(
+    l: *const sys::mrsh_command_list,
+) -> (sys::mrsh_position, sys::mrsh_position) {
+    let mut begin = sys::mrsh_position {
+        offset: 0,
+        line: 0,
+        column: 0,
+    };
+    let mut end = begin;
+    let mut first = true;
+    and_or_list_commands((*l).and_or_list, &mut |cmd| {
+        let (mut b, mut e) = (begin, end);
+        sys::mrsh_command_range(cmd, &mut b, &mut e);
+        if first {
+            begin = b;
+            first = false;
+        }
+        end = e;
+    });
+    (begin, end)
+}
+
+unsafe fn and_or_list_commands(
+    and_or_list: *const sys::mrsh_and_or_list,
+    f: &mut dyn FnMut(*mut sys::mrsh_command),
+) {
+    match (*and_or_list).type_ {
+        sys::MRSH_AND_OR_LIST_PIPELINE => {
+            let pl = &*sys::mrsh_and_or_list_get_pipeline(and_or_list);
+            for &cmd in array_slice(&pl.commands) {
+                f(cmd);
+            }
+        }
+        sys::MRSH_AND_OR_LIST_BINOP => {
+            let binop = &*sys::mrsh_and_or_list_get_binop(and_or_list);
+            and_or_list_commands(binop.left, f);
+            and_or_list_commands(binop.right, f);
+        }
+        _ => unreachable!(),
+    }
+}
+
+unsafe fn and_or_list_label(and_or_list: *const sys::mrsh_and_or_list) -> String {
+    match (*and_or_list).type_ {
+        sys::MRSH_AND_OR_LIST_PIPELINE => {
+            let pl = &*sys::mrsh_and_or_list_get_pipeline(and_or_list);
+            let commands = array_slice(&pl.commands)
+                .iter()
+                .map(|&cmd| command_label(cmd))
+                .collect::<Vec<_>>();
+            let label = commands.join(" | ");
+            if pl.bang {
+                format!("! {}", label)
+            } else {
+                label
+            }
+        }
+        sys::MRSH_AND_OR_LIST_BINOP => {
+            let binop = &*sys::mrsh_and_or_list_get_binop(and_or_list);
+            let op = if binop.type_ == sys::MRSH_BINOP_AND {
+                "&&"
+            } else {
+                "||"
+            };
+            format!(
+                "{} {} {}",
+                and_or_list_label(binop.left),
+                op,
+                and_or_list_label(binop.right)
+            )
+        }
+        _ => unreachable!(),
+    }
+}
+
+unsafe fn command_label(cmd: *const sys::mrsh_command) -> String {
+    match (*cmd).type_ {
+        sys::MRSH_SIMPLE_COMMAND => {
+            let sc = &*sys::mrsh_command_get_simple_command(cmd);
+            if sc.name.is_null() {
+                return "assignment".to_owned();
+            }
+            let name = sys::mrsh_word_str(sc.name);
+            let label = CStr::from_ptr(name).to_string_lossy().into_owned();
+            libc::free(name.cast());
+            label
+        }
+        sys::MRSH_BRACE_GROUP => "{ }".to_owned(),
+        sys::MRSH_SUBSHELL => "( )".to_owned(),
+        sys::MRSH_IF_CLAUSE => "if".to_owned(),
+        sys::MRSH_FOR_CLAUSE => {
+            let fc = &*sys::mrsh_command_get_for_clause(cmd);
+            format!("for {}", CStr::from_ptr(fc.name).to_string_lossy())
+        }
+        sys::MRSH_LOOP_CLAUSE => {
+            let lc = &*sys::mrsh_command_get_loop_clause(cmd);
+            if lc.type_ == sys::MRSH_LOOP_WHILE {
+                "while".to_owned()
+            } else {
+                "until".to_owned()
+            }
+        }
+        sys::MRSH_CASE_CLAUSE => "case".to_owned(),
+        sys::MRSH_FUNCTION_DEFINITION => {
+            let fd = &*sys::mrsh_command_get_function_definition(cmd);
+            format!("{}()", CStr::from_ptr(fd.name).to_string_lossy())
+        }
+        _ => unreachable!(),
+    }
+}
+
+/// Wall time per command, in the folded-stack format used by flame graph
+/// tools (`script;line: label microseconds`).
+pub struct Profile {
+    script: String,
+    stacks: BTreeMap<String, u64>,
+}
+
+impl Profile {
+    pub fn new(script: &str) -> Profile {
+        Profile {
+            script: frame(script),
+            stacks: BTreeMap::new(),
+        }
+    }
+
+    pub fn record(&mut self, trace: &Trace) {
+        let stack = format!(
+            "{};{}: {}",
+            self.script,
+            trace.begin.line,
+            frame(&trace.label)
+        );
+        *self.stacks.entry(stack).or_insert(0) += trace.wall.as_micros() as u64;
+    }
+
+    pub fn write_folded<W: Write>(&self, mut w: W) -> io::Result<()> {
+        for (stack, micros) in &self.stacks {
+            writeln!(w, "{} {}", stack, micros)?;
+        }
+        Ok(())
+    }
+}
+
+/// Frames are separated by semicolons and a sample by newlines.
+fn frame(name: &str) -> String {
+    name.replace(';', ",").replace('\n', " ")
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn position(line: c_int) -> sys::mrsh_position {
+        sys::mrsh_position {
+            offset: 0,
+            line,
+            column: 1,
+        }
+    }
+
+    #[test]
+    fn traces_each_list() {
+        let prog = Program::parse(
+            b"x=1\n\
+              f() { :; }\n\
+              ! true | false && f || echo no\n\
+              for i in 1 2; do :; done; false\n\
+              exit 3\n\
+              echo unreachable\n",
+        )
+        .unwrap();
+        let mut traces = Vec::new();
+        let status = State::new().run_program_traced(&prog, |t| traces.push(t.clone()));
+        assert_eq!(status, 3);
+        let got = traces
+            .iter()
+            .map(|t| (t.begin.line, t.label.as_str(), t.status))
+            .collect::<Vec<_>>();
+        assert_eq!(
+            got,
+            [
+                (1, "assignment", 0),
+                (2, "f()", 0),
+                (3, "! true | false && f || echo", 0),
+                (4, "for i", 0),
+                (4, "false", 1),
+                (5, "exit", 3),
+            ]
+        );
+        for t in &traces {
+            assert!(t.end.offset >= t.begin.offset, "{}", t.label);
+        }
+    }
+
+    #[test]
+    fn folded_output() {
+        let mut profile = Profile::new("deploy;prod\nsh");
+        let trace = |line, label: &str, micros| Trace {
+            begin: position(line),
+            end: position(line),
+            label: label.to_owned(),
+            status: 0,
+            wall: Duration::from_micros(micros),
+            cpu: CpuTime::default(),
+        };
+        profile.record(&trace(2, "upload && activate", 5));
+        profile.record(&trace(1, "a; b", 7));
+        profile.record(&trace(2, "upload && activate", 10));
+
+        let mut out = Vec::new();
+        profile.write_folded(&mut out).unwrap();
+        assert_eq!(
+            String::from_utf8(out).unwrap(),
+            "deploy,prod sh;1: a, b 7\n\
+             deploy,prod sh;2: upload && activate 15\n"
+        );
+    }
+}